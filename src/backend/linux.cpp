@@ -11,6 +11,7 @@ struct WindowData {
   ::Window window;
   XImage* image;
   Atom destroy;
+  CompactImage frame; // RGB565 copy of the framebuffer, presented on 16-bit visuals
 };
 
 static std::unordered_map<Window*, WindowData> windows;
@@ -20,6 +21,15 @@ static ::Window root;
 static GC gc;
 
 #pragma region NextFrame
+// * XImage over what gets presented: the framebuffer itself, or its RGB565 copy on 16-bit visuals
+static XImage* createImage(Window& window, WindowData& data) {
+  if (visualInfo.depth == 16) {
+    data.frame.setSize(window.size());
+    return ::XCreateImage(display, visualInfo.visual, 16, ZPixmap, 0, (char*)data.frame.data(), window.width(), window.height(), 16, static_cast<int>(data.frame.stride()));
+  }
+  return ::XCreateImage(display, visualInfo.visual, static_cast<unsigned int>(visualInfo.depth), ZPixmap, 0, (char*)window.data(), window.width(), window.height(), 8, static_cast<int>(window.width() * 4));
+}
+
 static void buttonEvent(const XButtonEvent& event) {
   static const MouseButton mouseButtonConversionTable[] = {MouseUndefined, MouseLeft, MouseMiddle, MouseRight};
   if ((event.button == Button4) && (event.type == ButtonPress)) _mouseScroll(0, -1);
@@ -77,9 +87,10 @@ void _nextFrame() {
     if (size != window->size()) {
       window->setSize(size);
       free(data.image);
-      data.image = ::XCreateImage(display, visualInfo.visual, static_cast<unsigned int>(visualInfo.depth), ZPixmap, 0, (char*)window->data(), size.x, size.y, 8, static_cast<int>(size.x * 4));
+      data.image = createImage(*window, data);
     }
 
+    if (visualInfo.depth == 16) data.frame.convert(*window);
     ::XPutImage(display, data.window, gc, data.image, 0, 0, 0, 0, window->width(), window->height());
   }
   ::XSync(display, false);
@@ -104,7 +115,11 @@ Window::Window(std::string_view title) {
     MV_ASSERT((display = ::XOpenDisplay(nullptr)) != nullptr, "Unable to open display!");
     root = ::XDefaultRootWindow(display);
 
-    MV_ASSERT(::XMatchVisualInfo(display, XDefaultScreen(display), 24, TrueColor, &visualInfo), "Supported visual not found!");
+    // 16-bit displays get the framebuffer converted to RGB565 when it is presented
+    if (!::XMatchVisualInfo(display, XDefaultScreen(display), 24, TrueColor, &visualInfo)) {
+      MV_ASSERT(::XMatchVisualInfo(display, XDefaultScreen(display), 16, TrueColor, &visualInfo), "Supported visual not found!");
+      MV_ASSERT(visualInfo.red_mask == 0xF800 && visualInfo.green_mask == 0x07E0 && visualInfo.blue_mask == 0x001F, "16-bit visual is not RGB565!");
+    }
 
     // Create GC
     XGCValues gcv;
@@ -124,7 +139,7 @@ Window::Window(std::string_view title) {
   }
 
   Image::setSize(width, height);
-  Image::setColorMode(colorModeBGR, reverseColorModeBGR);
+  Image::setPixelFormat(PixelFormat::BGRA);
   MV_ASSERT(m_Data, "Unable to create framebuffer!");
 
   { // Create Window
@@ -140,7 +155,7 @@ Window::Window(std::string_view title) {
   data.destroy = XInternAtom(display, "WM_DELETE_WINDOW", True);
   XSetWMProtocols(display, data.window, &data.destroy, 1);
 
-  data.image = ::XCreateImage(display, visualInfo.visual, static_cast<unsigned int>(visualInfo.depth), ZPixmap, 0, (char*)m_Data, width, height, 8, width * 4);
+  data.image = createImage(*this, data);
   MV_ASSERT(data.image != nullptr, "Unable to create framebuffer image!");
   ::XMapWindow(display, data.window);
   setTitle(title);
@@ -141,7 +141,7 @@ Window::Window(std::string_view title) : m_Open(true) {
   RECT rect;
   GetClientRect(data.hWnd, &rect);
   Image::setSize(rect.right - rect.left, rect.bottom - rect.top);
-  Image::setColorMode(colorModeBGR, reverseColorModeBGR);
+  Image::setPixelFormat(PixelFormat::BGRA);
   MV_ASSERT(m_Data, "Unable to create framebuffer!");
 }
 
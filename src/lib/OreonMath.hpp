@@ -274,18 +274,18 @@ template <typename T> struct Rect {
   bool intersects(const Rect<T>& other) const { return overlaps(other); }
   Rect<T> intersection(const Rect<T> other) const {
     if (!intersects(other)) return zero;
-    vec2<T> tl = max(tl(), other.tl()), br = min(br(), other.br());
-    return Rect<T>(tl, br - tl);
+    vec2<T> topLeft = max(tl(), other.tl()), bottomRight = min(br(), other.br());
+    return Rect<T>(topLeft, bottomRight - topLeft);
   }
 
   Rect<T> common(const Rect<T> other) const {
-    vec2<T> tl = min(tl(), other.tl()), br = max(br(), other.br());
-    return Rect<T>(tl, br - tl);
+    vec2<T> topLeft = min(tl(), other.tl()), bottomRight = max(br(), other.br());
+    return Rect<T>(topLeft, bottomRight - topLeft);
   }
 
   Rect<T> common(const vec2<T> v) const {
-    vec2<T> tl = min(tl(), v), br = max(br(), v);
-    return Rect<T>(tl, br - tl);
+    vec2<T> topLeft = min(tl(), v), bottomRight = max(br(), v);
+    return Rect<T>(topLeft, bottomRight - topLeft);
   }
 
   Rect<T> scaleCenter(float scale) { return Rect<T>(center() - size() * scale / 2, size() * scale); }
@@ -326,6 +326,66 @@ template <typename T> struct Rect {
 };
 
 template <typename T> const Rect<T> Rect<T>::zero = Rect<T>(0, 0, 0, 0);
+
+// ---------- Mat3 ----------
+// 2D transform in homogeneous coordinates, row-major: x' = m[0][0] * x + m[0][1] * y + m[0][2]
+template <typename T> struct mat3 {
+  T m[3][3];
+
+  mat3() : mat3(1, 0, 0, 0, 1, 0) {}
+  mat3(T a, T b, T c, T d, T e, T f) : mat3(a, b, c, d, e, f, 0, 0, 1) {}
+  mat3(T a, T b, T c, T d, T e, T f, T g, T h, T i) : m{{a, b, c}, {d, e, f}, {g, h, i}} {}
+
+  static mat3<T> identity() { return mat3<T>(); }
+  static mat3<T> translation(const vec2<T>& v) { return mat3<T>(1, 0, v.x, 0, 1, v.y); }
+  static mat3<T> scale(const vec2<T>& v) { return mat3<T>(v.x, 0, 0, 0, v.y, 0); }
+  static mat3<T> scale(T v) { return scale(vec2<T>(v, v)); }
+  static mat3<T> rotation(float angle) { return mat3<T>(cos(angle), -sin(angle), 0, sin(angle), cos(angle), 0); }
+  static mat3<T> shear(const vec2<T>& v) { return mat3<T>(1, v.x, 0, v.y, 1, 0); }
+
+  mat3<T> operator*(const mat3<T>& other) const {
+    mat3<T> result(0, 0, 0, 0, 0, 0, 0, 0, 0);
+    for (int row = 0; row < 3; row++)
+      for (int column = 0; column < 3; column++)
+        for (int k = 0; k < 3; k++) result.m[row][column] += m[row][k] * other.m[k][column];
+    return result;
+  }
+  mat3<T>& operator*=(const mat3<T>& other) { return *this = *this * other; }
+  bool operator==(const mat3<T>& other) const {
+    for (int i = 0; i < 9; i++)
+      if (m[i / 3][i % 3] != other.m[i / 3][i % 3]) return false;
+    return true;
+  }
+  bool operator!=(const mat3<T>& other) const { return !(*this == other); }
+
+  // Points get the translation (and the projective divide), vectors don't
+  vec2<T> operator*(const vec2<T>& v) const {
+    const T w = m[2][0] * v.x + m[2][1] * v.y + m[2][2];
+    const vec2<T> p(m[0][0] * v.x + m[0][1] * v.y + m[0][2], m[1][0] * v.x + m[1][1] * v.y + m[1][2]);
+    return w == 1 ? p : p / w;
+  }
+  vec2<T> transformVector(const vec2<T>& v) const { return vec2<T>(m[0][0] * v.x + m[0][1] * v.y, m[1][0] * v.x + m[1][1] * v.y); }
+
+  T determinant() const { return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]); }
+  // Singular matrices have no inverse, they give the identity
+  mat3<T> inverse() const {
+    const T det = determinant();
+    if (det == 0) return mat3<T>();
+    const T inv = 1 / det;
+    return mat3<T>((m[1][1] * m[2][2] - m[1][2] * m[2][1]) * inv, (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv, (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv,
+                   (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * inv, (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv, (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv,
+                   (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * inv, (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv, (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv);
+  }
+
+  vec2<T> translationPart() const { return vec2<T>(m[0][2], m[1][2]); }
+  vec2<T> scalePart() const { return vec2<T>(m[0][0], m[1][1]); }
+  bool isAffine() const { return m[2][0] == 0 && m[2][1] == 0 && m[2][2] == 1; }
+  bool isAxisAligned() const { return isAffine() && m[0][1] == 0 && m[1][0] == 0; } // Translation and scale only
+  bool isTranslation() const { return isAxisAligned() && m[0][0] == 1 && m[1][1] == 1; }
+  bool isIdentity() const { return isTranslation() && m[0][2] == 0 && m[1][2] == 0; }
+};
+
+typedef mat3<float> mat3f;
 } // namespace VectorMath
 
 #ifdef OREON_MATH_MIN_DEF
@@ -0,0 +1,137 @@
+#include "movaAllocator.hpp"
+#include "lib/logassert.h"
+#include <cstdlib>
+#include <platform.h>
+
+#if defined(__LINUX__)
+#include <sys/mman.h>
+#elif defined(__WINDOWS__)
+#include <malloc.h>
+#endif
+
+namespace Mova {
+#pragma region SizeClasses
+// Classes go 4K, 6K, 8K, 12K, 16K, ... (powers of two and one and a half of them), so at most a third of a block is wasted
+size_t PoolAllocator::blockSize(size_t size) {
+  if (size <= minBlockSize) return minBlockSize;
+  size_t power = minBlockSize;
+  while (power * 2 <= size) power *= 2;
+  if (size == power) return power;
+  if (size <= power + power / 2) return power + power / 2;
+  return power * 2;
+}
+
+uint32_t PoolAllocator::sizeClass(size_t capacity) {
+  uint32_t index = 0;
+  size_t power = minBlockSize;
+  while (power * 2 <= capacity) power *= 2, index += 2;
+  return index + (capacity != power);
+}
+#pragma endregion SizeClasses
+#pragma region System
+uint8_t* PoolAllocator::systemAllocate(size_t capacity) {
+  m_Stats.systemAllocations++;
+#if defined(__LINUX__)
+  // Big framebuffers get their own mapping, which can be backed by transparent huge pages
+  if (capacity >= hugePageSize) {
+    void* data = ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    MV_ASSERT(data != MAP_FAILED, "Unable to map %zu bytes for an image!", capacity);
+    if (m_HugePages && ::madvise(data, capacity, MADV_HUGEPAGE) == 0) m_Stats.hugePageAllocations++;
+    return static_cast<uint8_t*>(data);
+  }
+#endif
+#if defined(__WINDOWS__)
+  void* data = ::_aligned_malloc(capacity, alignment);
+#else
+  void* data = std::aligned_alloc(alignment, capacity);
+#endif
+  MV_ASSERT(data, "Unable to allocate %zu bytes for an image!", capacity);
+  return static_cast<uint8_t*>(data);
+}
+
+void PoolAllocator::systemDeallocate(uint8_t* data, size_t capacity) {
+#if defined(__LINUX__)
+  if (capacity >= hugePageSize) {
+    ::munmap(data, capacity);
+    return;
+  }
+#endif
+#if defined(__WINDOWS__)
+  ::_aligned_free(data);
+#else
+  std::free(data);
+#endif
+}
+#pragma endregion System
+#pragma region Pool
+uint8_t* PoolAllocator::allocate(size_t size, size_t& capacity) {
+  capacity = blockSize(size);
+  const uint32_t index = sizeClass(capacity);
+
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_Stats.allocations++;
+  m_Stats.bytesInUse += capacity;
+  if (index < m_FreeLists.size() && !m_FreeLists[index].empty()) {
+    uint8_t* data = m_FreeLists[index].back();
+    m_FreeLists[index].pop_back();
+    m_Stats.poolHits++;
+    m_Stats.bytesPooled -= capacity;
+    return data;
+  }
+  return systemAllocate(capacity);
+}
+
+void PoolAllocator::deallocate(uint8_t* data, size_t capacity) {
+  if (!data) return;
+  const uint32_t index = sizeClass(capacity);
+
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_Stats.bytesInUse -= capacity;
+  if (m_Stats.bytesPooled + capacity > m_MaxPooledBytes) {
+    systemDeallocate(data, capacity);
+    return;
+  }
+  if (index >= m_FreeLists.size()) m_FreeLists.resize(index + 1);
+  m_FreeLists[index].push_back(data);
+  m_Stats.bytesPooled += capacity;
+}
+
+void PoolAllocator::trim() {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  size_t capacity = minBlockSize;
+  for (uint32_t index = 0; index < m_FreeLists.size(); index++) {
+    // Even classes are powers of two, odd ones are one and a half of the previous power
+    const size_t blockCapacity = (index & 1) ? capacity + capacity / 2 : capacity;
+    for (uint8_t* data : m_FreeLists[index]) systemDeallocate(data, blockCapacity);
+    m_FreeLists[index].clear();
+    if (index & 1) capacity *= 2;
+  }
+  m_Stats.bytesPooled = 0;
+}
+
+AllocatorStats PoolAllocator::stats() {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_Stats;
+}
+
+void PoolAllocator::resetStats() {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_Stats.allocations = m_Stats.poolHits = m_Stats.systemAllocations = m_Stats.hugePageAllocations = 0;
+}
+#pragma endregion Pool
+#pragma region Default
+PoolAllocator& getDefaultPool() {
+  static PoolAllocator pool;
+  return pool;
+}
+
+static ImageAllocator* defaultAllocator = nullptr;
+
+ImageAllocator& getDefaultAllocator() {
+  if (!defaultAllocator) defaultAllocator = &getDefaultPool();
+  return *defaultAllocator;
+}
+
+void setDefaultAllocator(ImageAllocator& allocator) { defaultAllocator = &allocator; }
+#pragma endregion Default
+} // namespace Mova
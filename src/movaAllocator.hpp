@@ -0,0 +1,70 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace Mova {
+struct AllocatorStats {
+  size_t allocations = 0;         // Total allocate() calls
+  size_t poolHits = 0;            // Allocations served from a free list
+  size_t systemAllocations = 0;   // Allocations that had to go to the system (and page fault on first touch)
+  size_t hugePageAllocations = 0; // System allocations backed by huge pages
+  size_t bytesInUse = 0;          // Capacity currently handed out
+  size_t bytesPooled = 0;         // Capacity kept in free lists
+};
+
+// Storage provider for Image pixels. Blocks must be at least 64-byte aligned
+class ImageAllocator {
+public:
+  static constexpr size_t alignment = 64;
+
+  virtual ~ImageAllocator() = default;
+  virtual uint8_t* allocate(size_t size, size_t& capacity) = 0;
+  virtual void deallocate(uint8_t* data, size_t capacity) = 0;
+};
+
+// Size-class pooled allocator. Freed blocks are kept (up to maxPooledBytes) and handed out again,
+// so a steady-state frame loop that creates and destroys temporary images doesn't touch the system allocator
+class PoolAllocator : public ImageAllocator {
+public:
+  static constexpr size_t minBlockSize = 4096;
+  static constexpr size_t hugePageSize = 2 * 1024 * 1024;
+
+  explicit PoolAllocator(size_t maxPooledBytes = 256 * 1024 * 1024, bool hugePages = true) : m_MaxPooledBytes(maxPooledBytes), m_HugePages(hugePages) {}
+  ~PoolAllocator() override { trim(); }
+
+  PoolAllocator(const PoolAllocator&) = delete;
+  PoolAllocator& operator=(const PoolAllocator&) = delete;
+
+  uint8_t* allocate(size_t size, size_t& capacity) override;
+  void deallocate(uint8_t* data, size_t capacity) override;
+
+  void trim(); // Return every pooled block to the system
+  AllocatorStats stats();
+  void resetStats();
+
+  void setMaxPooledBytes(size_t maxPooledBytes) { m_MaxPooledBytes = maxPooledBytes; }
+  void setHugePages(bool hugePages) { m_HugePages = hugePages; }
+
+  static size_t blockSize(size_t size);
+
+protected:
+  static uint32_t sizeClass(size_t capacity);
+  uint8_t* systemAllocate(size_t capacity);
+  void systemDeallocate(uint8_t* data, size_t capacity);
+
+  std::mutex m_Mutex;
+  std::vector<std::vector<uint8_t*>> m_FreeLists;
+  AllocatorStats m_Stats;
+  size_t m_MaxPooledBytes;
+  bool m_HugePages;
+};
+
+ImageAllocator& getDefaultAllocator();
+void setDefaultAllocator(ImageAllocator& allocator);
+PoolAllocator& getDefaultPool();
+} // namespace Mova
+
+using MvImageAllocator = Mova::ImageAllocator;
+using MvPoolAllocator = Mova::PoolAllocator;
@@ -0,0 +1,164 @@
+#include "lib/OreonMath.hpp"
+#include "lib/logassert.h"
+#include "movaImage.hpp"
+#include "movaKernels.hpp"
+#include <cstring>
+
+/*
+--- Image atlas ---
+Pages are packed with stb_rect_pack's skyline packer. Every page keeps its packer, so later insertions fill the space
+above the skyline of earlier ones. Entries are addressed through handles, so repacking only rewrites the entry table
+*/
+
+using namespace VectorMath;
+
+namespace Mova {
+// * Copies source from one image to position in another, converting the pixel format
+static void copyPixels(const Image& from, Rect<uint32_t> source, Image& to, vec2u position) {
+  const Kernels::PixelConverter convert(from, to);
+  const bool same = from.pixelFormat() == to.pixelFormat() && from.pixelFormat() != PixelFormat::Custom;
+  for (uint32_t y = 0; y < source.height; y++) {
+    const uint32_t* src = from.row(source.y + y) + source.x;
+    uint32_t* dst = to.row(position.y + y) + position.x;
+    if (same) memcpy(dst, src, source.width * sizeof(uint32_t));
+    else for (uint32_t x = 0; x < source.width; x++) dst[x] = convert(src[x]);
+  }
+}
+
+/**
+ * @brief Create an empty atlas
+ *
+ * @param pageSize Width and height of a page. Larger images get a page of their own
+ * @param padding Transparent pixels kept between entries
+ * @param format Pixel format of the pages, images of another format are converted
+ */
+ImageAtlas::ImageAtlas(uint32_t pageSize, uint32_t padding, PixelFormat format) : m_PageSize(pageSize), m_Padding(padding), m_Format(format) {
+  MV_ASSERT(pageSize > padding, "Atlas page size must be larger than the padding!");
+  MV_ASSERT(format != PixelFormat::Custom, "Atlas pages need a built-in pixel format!");
+}
+
+ImageAtlas::Page& ImageAtlas::addPage(vec2u size, bool shared) {
+  m_Pages.push_back(std::make_unique<Page>());
+  Page& page = *m_Pages.back();
+  page.image.setSize(size.x, size.y);
+  page.image.setPixelFormat(m_Format);
+  page.image.clear(Color::transperent);
+  page.shared = shared;
+  if (shared) {
+    page.nodes.resize(size.x);
+    stbrp_init_target(&page.context, size.x, size.y, page.nodes.data(), page.nodes.size());
+  }
+  return page;
+}
+
+void ImageAtlas::pack(std::vector<stbrp_rect>& rects) {
+  size_t remaining = rects.size();
+  for (size_t index = 0; remaining > 0; index++) {
+    if (index == m_Pages.size()) addPage(vec2u(m_PageSize, m_PageSize), true);
+    Page& page = *m_Pages[index];
+    if (!page.shared) continue;
+    // Rects placed in this page are swapped behind the remaining ones, so every page only sees what is left
+    stbrp_pack_rects(&page.context, rects.data(), remaining);
+    for (size_t i = 0; i < remaining;) {
+      if (!rects[i].was_packed) {
+        i++;
+        continue;
+      }
+      Entry& entry = m_Entries[rects[i].id];
+      entry.page = index;
+      entry.rect = Rect<uint32_t>(rects[i].x, rects[i].y, rects[i].w - m_Padding, rects[i].h - m_Padding);
+      std::swap(rects[i], rects[--remaining]);
+    }
+  }
+}
+
+/**
+ * @brief Copy images into the atlas. Packing them in one call places them better than adding them one by one
+ *
+ * @param images Images to add
+ * @return Handles of the images, in the same order
+ */
+std::vector<ImageAtlas::Handle> ImageAtlas::add(const std::vector<const Image*>& images) {
+  std::vector<Handle> handles(images.size());
+  std::vector<stbrp_rect> rects;
+  rects.reserve(images.size());
+  for (size_t i = 0; i < images.size(); i++) {
+    MV_ASSERT(images[i] && images[i]->data(), "Cannot add to atlas: Image data is null!");
+    if (!m_Free.empty()) handles[i] = m_Free.back(), m_Free.pop_back();
+    else handles[i] = m_Entries.size(), m_Entries.emplace_back();
+    Entry& entry = m_Entries[handles[i]];
+    entry.used = true;
+    if (oversized(images[i]->size())) {
+      addPage(images[i]->size(), false);
+      entry.page = m_Pages.size() - 1, entry.rect = Rect<uint32_t>(0, 0, images[i]->width(), images[i]->height());
+      continue;
+    }
+    stbrp_rect rect = {};
+    rect.id = handles[i], rect.w = images[i]->width() + m_Padding, rect.h = images[i]->height() + m_Padding;
+    rects.push_back(rect);
+  }
+  pack(rects);
+  for (size_t i = 0; i < images.size(); i++) {
+    const Entry& entry = m_Entries[handles[i]];
+    copyPixels(*images[i], Rect<uint32_t>(0, 0, images[i]->width(), images[i]->height()), m_Pages[entry.page]->image, entry.rect.position());
+  }
+  return handles;
+}
+
+/**
+ * @brief Copy an image into the atlas
+ *
+ * @param image Image to add
+ * @return Handle of the image
+ */
+ImageAtlas::Handle ImageAtlas::add(const Image& image) { return add(std::vector<const Image*>{&image})[0]; }
+
+/**
+ * @brief Free a handle. Its pixels stay in the page until repack
+ *
+ * @param handle Handle to free
+ */
+void ImageAtlas::remove(Handle handle) {
+  MV_ASSERT(contains(handle), "Cannot remove from atlas: Invalid handle!");
+  if (!contains(handle)) return;
+  m_Entries[handle].used = false;
+  m_Free.push_back(handle);
+}
+
+/**
+ * @brief Pack every live entry again, dropping the space of removed ones. Handles stay valid, their pages and rects change
+ */
+void ImageAtlas::repack() {
+  std::vector<std::unique_ptr<Page>> old;
+  old.swap(m_Pages);
+  std::vector<Entry> previous = m_Entries;
+  std::vector<stbrp_rect> rects;
+  for (Handle handle = 0; handle < m_Entries.size(); handle++) {
+    Entry& entry = m_Entries[handle];
+    if (!entry.used) continue;
+    // Oversized entries keep their page
+    if (!old[entry.page]->shared) {
+      m_Pages.push_back(std::move(old[entry.page]));
+      entry.page = m_Pages.size() - 1;
+      continue;
+    }
+    stbrp_rect rect = {};
+    rect.id = handle, rect.w = entry.rect.width + m_Padding, rect.h = entry.rect.height + m_Padding;
+    rects.push_back(rect);
+  }
+  pack(rects);
+  for (const stbrp_rect& rect : rects) {
+    const Entry &from = previous[rect.id], &to = m_Entries[rect.id];
+    copyPixels(old[from.page]->image, from.rect, m_Pages[to.page]->image, to.rect.position());
+  }
+}
+
+/**
+ * @brief Remove every entry and page
+ */
+void ImageAtlas::clear() {
+  m_Pages.clear();
+  m_Entries.clear();
+  m_Free.clear();
+}
+} // namespace Mova
@@ -0,0 +1,219 @@
+#include "lib/OreonMath.hpp"
+#include "lib/logassert.h"
+#include "movaImage.hpp"
+#include "movaKernels.hpp"
+#include <cmath>
+#include <cstring>
+#include <map>
+
+/*
+--- Blur and shadows ---
+Box blurs run as a sliding window sum, so a pass costs the same at any radius. Rows are summed along the row and columns
+with one accumulator per column, which walks the image a row at a time. A Gaussian is three box passes.
+Shadows are blurred once per (radius, corner radius) into a nine-slice tile, after which a shadow of any size is a masked fill
+*/
+
+using namespace VectorMath;
+
+namespace Mova {
+#pragma region Blur
+// * Box radii of the passes making up a filter, returns the pass count
+static uint32_t blurPasses(float radius, BlurFilter filter, uint32_t (&radii)[3]) {
+  if (radius <= 0) return 0;
+  if (filter == BlurFilter::Box) {
+    radii[0] = static_cast<uint32_t>(radius + 0.5f);
+    return radii[0] > 0 ? 1 : 0;
+  }
+  // Box widths whose three passes add up to the Gaussian's variance
+  const float sigma = radius / 2;
+  int32_t lower = static_cast<int32_t>(sqrtf(12 * sigma * sigma / 3 + 1));
+  if (lower % 2 == 0) lower--;
+  const int32_t upperCount = 3 - Math::clamp(Math::round((12 * sigma * sigma - 3 * lower * lower - 12 * lower - 9) / (-4.f * lower - 4)), 0, 3);
+  uint32_t passes = 0;
+  for (uint32_t i = 0; i < 3; i++) {
+    const uint32_t width = i < 3 - static_cast<uint32_t>(upperCount) ? lower : lower + 2;
+    if (width / 2 > 0) radii[passes++] = width / 2;
+  }
+  return passes;
+}
+
+// How far a filter spreads a pixel
+static uint32_t blurReach(float radius, BlurFilter filter) {
+  uint32_t radii[3], reach = 0;
+  const uint32_t passes = blurPasses(radius, filter, radii);
+  for (uint32_t i = 0; i < passes; i++) reach += radii[i];
+  return reach;
+}
+
+// * Box pass along rows [begin, end), all channels at once. Each row slides a window along a copy of itself.
+// Averages are sum * scale >> 16, exact enough for 8 bits. Parameters are plain locals, so the byte stores can't alias them
+template <uint32_t Channels> static void boxRows(uint8_t* data, size_t stride, uint32_t width, uint32_t begin, uint32_t end, int32_t radius, uint32_t scale) {
+  static thread_local std::vector<uint8_t> line;
+  line.resize(static_cast<size_t>(width) * Channels);
+  const uint8_t* in = line.data();
+  const int32_t last = width - 1;
+  for (uint32_t y = begin; y < end; y++) {
+    uint8_t* out = data + y * stride;
+    std::memcpy(line.data(), out, line.size());
+    uint32_t sums[Channels];
+    for (uint32_t c = 0; c < Channels; c++) {
+      sums[c] = in[c] * (radius + 1);
+      for (int32_t i = 1; i <= radius; i++) sums[c] += in[Math::min(i, last) * Channels + c];
+    }
+    for (int32_t x = 0; x <= last; x++) {
+      const uint8_t* add = in + Math::min(x + radius + 1, last) * Channels;
+      const uint8_t* remove = in + Math::max(x - radius, 0) * Channels;
+      for (uint32_t c = 0; c < Channels; c++) {
+        out[x * Channels + c] = static_cast<uint8_t>((sums[c] * scale + 32768) >> 16);
+        sums[c] += add[c] - remove[c];
+      }
+    }
+  }
+}
+
+// Row-long steps of the column pass. Restrict tells the compiler the byte stores can't hit the sums, so both loops vectorize
+static void addRow(uint32_t* __restrict sum, const uint8_t* __restrict in, uint32_t count) {
+  for (uint32_t x = 0; x < count; x++) sum[x] += in[x];
+}
+
+static void slideRow(uint8_t* __restrict out, uint32_t* __restrict sum, const uint8_t* add, const uint8_t* remove, uint32_t count, uint32_t scale) {
+  for (uint32_t x = 0; x < count; x++) {
+    out[x] = static_cast<uint8_t>((sum[x] * scale + 32768) >> 16);
+    sum[x] += add[x] - remove[x];
+  }
+}
+
+// * Box pass down the byte columns [begin, end). A sum per column walks down a copy of the band, so every step is a row-long loop
+static void boxColumns(uint8_t* data, size_t stride, uint32_t height, uint32_t begin, uint32_t end, int32_t radius, uint32_t scale) {
+  const uint32_t bytes = end - begin;
+  static thread_local std::vector<uint8_t> band;
+  static thread_local std::vector<uint32_t> sums;
+  band.resize(static_cast<size_t>(bytes) * height);
+  sums.assign(bytes, 0);
+  uint8_t* copy = band.data();
+  for (uint32_t y = 0; y < height; y++) std::memcpy(copy + static_cast<size_t>(y) * bytes, data + y * stride + begin, bytes);
+  const int32_t last = height - 1;
+  auto copyRow = [&](int32_t y) { return copy + static_cast<size_t>(Math::clamp(y, 0, last)) * bytes; };
+  for (int32_t i = -radius; i <= radius; i++) addRow(sums.data(), copyRow(i), bytes);
+  for (int32_t y = 0; y <= last; y++) slideRow(data + y * stride + begin, sums.data(), copyRow(y + radius + 1), copyRow(y - radius), bytes, scale);
+}
+
+// * One box pass over Channels interleaved 8-bit channels, in place, split over threads. width is in pixels, stride in bytes
+template <uint32_t Channels> static void boxBlur(uint8_t* data, size_t stride, uint32_t width, uint32_t height, uint32_t radius) {
+  const uint32_t window = 2 * radius + 1, scale = (65536 + window / 2) / window;
+  Kernels::parallelFor(height, 64, [&](uint32_t begin, uint32_t end) { boxRows<Channels>(data, stride, width, begin, end, radius, scale); });
+  Kernels::parallelFor(width * Channels, 256, [&](uint32_t begin, uint32_t end) { boxColumns(data, stride, height, begin, end, radius, scale); });
+}
+
+template <uint32_t Channels> static void blur(uint8_t* data, size_t stride, uint32_t width, uint32_t height, float radius, BlurFilter filter) {
+  uint32_t radii[3];
+  const uint32_t passes = blurPasses(radius, filter, radii);
+  for (uint32_t i = 0; i < passes; i++) boxBlur<Channels>(data, stride, width, height, radii[i]);
+}
+
+/**
+ * @brief Blur the image in place. Pixels past the edges repeat the edge pixels
+ *
+ * @param radius Box half width, or twice the Gaussian's standard deviation
+ * @param filter Box or Gaussian
+ */
+void Image::blur(float radius, BlurFilter filter) {
+  MV_ASSERT(m_Data, "Cannot blur: Image data is null!");
+  Mova::blur<4>(m_Data, m_Stride, m_Width, m_Height, radius, filter);
+}
+
+/**
+ * @brief Blur the mask in place. Pixels past the edges repeat the edge pixels
+ *
+ * @param radius Box half width, or twice the Gaussian's standard deviation
+ * @param filter Box or Gaussian
+ */
+void Mask::blur(float radius, BlurFilter filter) {
+  MV_ASSERT(m_Data, "Cannot blur: Mask data is null!");
+  Mova::blur<1>(m_Data, m_Width, m_Width, m_Height, radius, filter);
+}
+#pragma endregion Blur
+
+#pragma region Shadow
+// * Blurred (rounded) rect of width x height, padded by the blur's reach on every side
+static void shadowMask(Mask& mask, float width, float height, float radius, uint32_t cornerRadius) {
+  const uint32_t reach = blurReach(radius, BlurFilter::Gaussian);
+  mask.setSize(static_cast<uint32_t>(ceilf(width)) + 2 * reach, static_cast<uint32_t>(ceilf(height)) + 2 * reach);
+  static thread_local Path path;
+  path.clear();
+  const float corner = Math::min(static_cast<float>(cornerRadius), Math::min(width, height) / 2);
+  mask.fillPath(path.roundRect(Rect<float>(reach, reach, width, height), corner, corner, corner, corner));
+  mask.blur(radius, BlurFilter::Gaussian);
+}
+
+// * Nine-slice shadow tile: a shape just long enough to have a flat middle row and column.
+// Its corners are (corner radius + 2 reach) wide, the middle row and column repeat along the edges
+static const Mask& shadowTile(float radius, uint8_t cornerRadius) {
+  static thread_local std::map<std::pair<int32_t, uint8_t>, Mask> tiles;
+  const std::pair<int32_t, uint8_t> key(Math::round(radius * 4), cornerRadius);
+  auto tile = tiles.find(key);
+  if (tile != tiles.end()) return tile->second;
+  if (tiles.size() >= 64) tiles.clear(); // Animated radii would otherwise grow the cache without bound
+  Mask& mask = tiles[key];
+  const uint32_t reach = blurReach(radius, BlurFilter::Gaussian);
+  const float side = 2.f * (cornerRadius + reach) + 1;
+  shadowMask(mask, side, side, radius, cornerRadius);
+  return mask;
+}
+
+/**
+ * @brief Draw a soft shadow of a (rounded) rect. Blurred tiles are cached per radius and corner radius,
+ * so repeated shadows of any size only blend a mask
+ *
+ * @param rect The casting rect, the shadow spreads past it by about 1.5 radius
+ * @param radius Blur radius, twice the Gaussian's standard deviation
+ * @param color Shadow color
+ * @param cornerRadius Corner radius of the casting rect
+ */
+void Image::drawShadow(Rect<int32_t> rect, float radius, Color color, uint8_t cornerRadius) {
+  MV_ASSERT(m_Data, "Cannot drawShadow: Image data is null!");
+  if (skipsColor(color)) return;
+  if (rect.width < 0) rect.x += rect.width, rect.width = -rect.width;
+  if (rect.height < 0) rect.y += rect.height, rect.height = -rect.height;
+  if (rect.width == 0 || rect.height == 0) return;
+  radius = Math::max(radius, 0.f);
+  const int32_t reach = blurReach(radius, BlurFilter::Gaussian);
+
+  // Rects too small for the tile's flat middle, or drawn under a scale or rotation, get their own mask
+  const int32_t corner = cornerRadius + 2 * reach;
+  if (rect.width + 2 * reach < 2 * corner + 1 || rect.height + 2 * reach < 2 * corner + 1 || (m_HasTransform && !m_Transform.isTranslation())) {
+    static thread_local Mask mask;
+    shadowMask(mask, rect.width, rect.height, radius, cornerRadius);
+    fillMask(mask, rect.x - reach, rect.y - reach, color);
+    return;
+  }
+  if (m_HasTransform) {
+    const vec2i offset = round(m_Transform.translationPart());
+    rect.x += offset.x, rect.y += offset.y;
+  }
+  const Mask& tile = shadowTile(radius, cornerRadius);
+
+  // The shadow covers the rect grown by the reach. Tile columns and rows are picked once per call
+  const Rect<int32_t> bounds(rect.x - reach, rect.y - reach, rect.width + 2 * reach, rect.height + 2 * reach);
+  Rect<int32_t> area = bounds;
+  if (!clip(area)) return;
+  auto slice = [&](int32_t offset, int32_t length) {
+    return offset < corner ? offset : offset >= length - corner ? 2 * corner + 1 - (length - offset) : corner;
+  };
+  static thread_local std::vector<uint32_t> columns;
+  static thread_local std::vector<uint8_t> coverage;
+  columns.resize(area.width), coverage.resize(area.width);
+  for (int32_t i = 0; i < area.width; i++) columns[i] = slice(area.x + i - bounds.x, bounds.width);
+
+  const uint32_t packed = colorMode(color);
+  const Kernels::Stencil stencil(*this);
+  Kernels::withBlendMode(m_BlendMode, [&](auto mode) {
+    for (int32_t y = area.top(); y < area.bottom(); y++) {
+      const uint8_t* source = tile.row(slice(y - bounds.y, bounds.height));
+      for (int32_t i = 0; i < area.width; i++) coverage[i] = source[columns[i]];
+      Kernels::fillSpanMask<decltype(mode)>(row(y) + area.x, coverage.data(), area.width, packed, stencil.span(area.x, y));
+    }
+  });
+}
+#pragma endregion Shadow
+} // namespace Mova
@@ -0,0 +1,200 @@
+#include "lib/OreonMath.hpp"
+#include "lib/logassert.h"
+#include "movaImage.hpp"
+#include "movaKernels.hpp"
+#include <cstring>
+
+/*
+--- Compact images ---
+RGB565 halves and palette indices quarter the memory and bandwidth of a 32-bit image.
+Conversions run a row at a time with the pixel format branch hoisted out of the loop, indexed conversion is one lookup in a
+nearest-color table over RGB555
+*/
+
+using namespace VectorMath;
+
+namespace Mova {
+#pragma region CompactImage
+CompactImage::CompactImage(uint32_t width, uint32_t height, CompactFormat format, std::vector<Color> palette) : m_Format(format) {
+  setSize(width, height);
+  if (!palette.empty()) setPalette(std::move(palette));
+}
+
+CompactImage& CompactImage::operator=(const CompactImage& other) {
+  if (this == &other) return *this;
+  m_Format = other.m_Format;
+  m_Palette = other.m_Palette;
+  m_Nearest = other.m_Nearest;
+  m_Transparent = other.m_Transparent;
+  if (!other.m_Data) {
+    if (m_Data) m_Allocator->deallocate(m_Data, m_Capacity);
+    m_Data = nullptr, m_Width = m_Height = 0, m_Capacity = 0;
+    return *this;
+  }
+  setSize(other.size());
+  std::memcpy(m_Data, other.m_Data, static_cast<size_t>(other.stride()) * other.m_Height);
+  return *this;
+}
+
+void CompactImage::swap(CompactImage& other) noexcept {
+  std::swap(m_Data, other.m_Data);
+  std::swap(m_Width, other.m_Width);
+  std::swap(m_Height, other.m_Height);
+  std::swap(m_Capacity, other.m_Capacity);
+  std::swap(m_Format, other.m_Format);
+  std::swap(m_Allocator, other.m_Allocator);
+  std::swap(m_Palette, other.m_Palette);
+  std::swap(m_Nearest, other.m_Nearest);
+  std::swap(m_Transparent, other.m_Transparent);
+}
+
+void CompactImage::setSize(uint32_t width, uint32_t height) {
+  MV_ASSERT(width > 0 && height > 0, "Invalid image size: %u%%%u", width, height);
+  const size_t bytes = static_cast<size_t>(width) * height * (m_Format == CompactFormat::RGB565 ? 2 : 1);
+  if (!m_Data || bytes > m_Capacity) {
+    if (m_Data) m_Allocator->deallocate(m_Data, m_Capacity);
+    m_Data = m_Allocator->allocate(bytes, m_Capacity);
+  }
+  m_Width = width;
+  m_Height = height;
+  std::memset(m_Data, 0, bytes);
+}
+
+void CompactImage::setPalette(std::vector<Color> palette) {
+  MV_ASSERT(palette.size() <= 256, "Palette has %zu colors, at most 256 fit in 8 bits!", palette.size());
+  if (palette.size() > 256) palette.resize(256);
+  m_Palette = std::move(palette);
+  m_Nearest.clear();
+  m_Transparent = -1;
+  for (size_t i = 0; i < m_Palette.size() && m_Transparent < 0; i++) {
+    if (m_Palette[i].a == 0) m_Transparent = static_cast<int32_t>(i);
+  }
+}
+
+Color CompactImage::get(uint32_t x, uint32_t y) const {
+  if (m_Format == CompactFormat::RGB565) return Color(Kernels::from565<false>(reinterpret_cast<const uint16_t*>(row(y))[x]));
+  const uint8_t index = row(y)[x];
+  return index < m_Palette.size() ? m_Palette[index] : Color::transperent;
+}
+
+// * Nearest visible palette entry for the center of every RGB555 cell
+static void buildNearest(const std::vector<Color>& palette, std::vector<uint8_t>& nearest) {
+  std::vector<uint8_t> candidates;
+  for (size_t i = 0; i < palette.size(); i++) {
+    if (palette[i].a != 0) candidates.push_back(static_cast<uint8_t>(i));
+  }
+  if (candidates.empty()) candidates.push_back(0);
+  nearest.resize(32 * 32 * 32);
+  for (uint32_t cell = 0; cell < nearest.size(); cell++) {
+    const int32_t r = ((cell >> 10) << 3) | 4, g = (((cell >> 5) & 0x1F) << 3) | 4, b = ((cell & 0x1F) << 3) | 4;
+    uint32_t best = ~0u;
+    for (uint8_t index : candidates) {
+      const Color& color = palette[index];
+      const int32_t dr = r - color.r, dg = g - color.g, db = b - color.b;
+      const uint32_t distance = dr * dr * 2 + dg * dg * 4 + db * db * 3; // Rough perceptual weights
+      if (distance < best) best = distance, nearest[cell] = index;
+    }
+  }
+}
+
+void CompactImage::convert(const Image& image) {
+  MV_ASSERT(image.data(), "Cannot convert: Image data is null!");
+  if (size() != image.size()) setSize(image.size());
+  const PixelFormat format = image.pixelFormat();
+
+  if (m_Format == CompactFormat::RGB565) {
+    for (uint32_t y = 0; y < m_Height; y++) {
+      uint16_t* dst = reinterpret_cast<uint16_t*>(row(y));
+      const uint32_t* src = image.row(y);
+      if (format == PixelFormat::RGBA) Kernels::packSpan565<false>(dst, src, m_Width);
+      else if (format == PixelFormat::BGRA) Kernels::packSpan565<true>(dst, src, m_Width);
+      else {
+        for (uint32_t x = 0; x < m_Width; x++) dst[x] = Kernels::to565<false>(image.unpack(src[x]).value);
+      }
+    }
+    return;
+  }
+
+  MV_ASSERT(!m_Palette.empty(), "Cannot convert: Indexed image has no palette!");
+  if (m_Palette.empty()) return;
+  if (m_Nearest.empty()) buildNearest(m_Palette, m_Nearest);
+  for (uint32_t y = 0; y < m_Height; y++) {
+    uint8_t* dst = row(y);
+    const uint32_t* src = image.row(y);
+    for (uint32_t x = 0; x < m_Width; x++) {
+      const uint32_t pixel = format == PixelFormat::RGBA ? src[x] : format == PixelFormat::BGRA ? Kernels::swapRB(src[x]) : image.unpack(src[x]).value;
+      if ((pixel >> 24) < 128 && m_Transparent >= 0) dst[x] = static_cast<uint8_t>(m_Transparent);
+      else dst[x] = m_Nearest[((pixel & 0xF8) << 7) | ((pixel >> 6) & 0x3E0) | ((pixel >> 19) & 0x1F)];
+    }
+  }
+}
+#pragma endregion CompactImage
+
+#pragma region Draw
+/**
+ * @brief Draw a compact image, unscaled
+ *
+ * @param image The image
+ * @param x X position
+ * @param y Y position
+ */
+void Image::drawImage(const CompactImage& image, int32_t x, int32_t y) {
+  MV_ASSERT(m_Data, "Cannot drawImage: Image data is null!");
+  MV_ASSERT(image.data(), "Cannot drawImage: Other image data is null!");
+  const bool indexed = image.format() == CompactFormat::Indexed8;
+  // Palette packed for this image once, indices past its end are transparent
+  uint32_t palette[256] = {};
+  if (indexed) {
+    for (size_t i = 0; i < image.palette().size(); i++) palette[i] = colorMode(image.palette()[i]);
+  }
+  auto sample = [&](uint32_t px, uint32_t py) {
+    if (indexed) return palette[image.row(py)[px]];
+    const uint16_t pixel = reinterpret_cast<const uint16_t*>(image.row(py))[px];
+    if (m_Format == PixelFormat::RGBA) return Kernels::from565<false>(pixel);
+    if (m_Format == PixelFormat::BGRA) return Kernels::from565<true>(pixel);
+    return colorMode(Color(Kernels::from565<false>(pixel)));
+  };
+
+  if (m_HasTransform) {
+    if (!m_Transform.isTranslation()) {
+      const vec2f corners[4] = {m_Transform * vec2f(x, y), m_Transform * vec2f(x + image.width(), y), m_Transform * vec2f(x + image.width(), y + image.height()), m_Transform * vec2f(x, y + image.height())};
+      const int32_t right = image.width() - 1, bottom = image.height() - 1;
+      Kernels::rasterizeQuad(*this, corners, mat3f::translation(vec2f(-x, -y)) * m_Transform.inverse(), [&](float u, float v) {
+        return sample(Math::clamp(static_cast<int32_t>(floorf(u)), 0, right), Math::clamp(static_cast<int32_t>(floorf(v)), 0, bottom));
+      });
+      return;
+    }
+    const vec2i offset = round(m_Transform.translationPart());
+    x += offset.x, y += offset.y;
+  }
+
+  Rect<int32_t> area(x, y, image.width(), image.height());
+  if (!clip(area)) return;
+  static thread_local std::vector<uint32_t> line;
+  line.resize(area.width);
+  const Kernels::Stencil stencil(*this);
+  Kernels::withBlendMode(m_BlendMode, [&](auto mode) {
+    using Mode = decltype(mode);
+    // RGB565 is opaque, so under Over and Copy it expands straight into the destination
+    const bool expandDirect = !indexed && m_Format != PixelFormat::Custom && m_StencilMode == StencilMode::Off && (std::is_same<Mode, Kernels::Blend::Over>::value || std::is_same<Mode, Kernels::Blend::Copy>::value);
+    for (int32_t y1 = area.top(); y1 < area.bottom(); y1++) {
+      uint32_t* dst = row(y1) + area.x;
+      const uint32_t sourceY = y1 - y, sourceX = area.x - x;
+      if (expandDirect) {
+        const uint16_t* source = reinterpret_cast<const uint16_t*>(image.row(sourceY)) + sourceX;
+        if (m_Format == PixelFormat::BGRA) Kernels::expandSpan565<true>(dst, source, area.width);
+        else Kernels::expandSpan565<false>(dst, source, area.width);
+        continue;
+      }
+      if (indexed) {
+        const uint8_t* source = image.row(sourceY) + sourceX;
+        for (int32_t i = 0; i < area.width; i++) line[i] = palette[source[i]];
+      } else {
+        for (int32_t i = 0; i < area.width; i++) line[i] = sample(sourceX + i, sourceY);
+      }
+      Kernels::blendSpan<Mode>(dst, line.data(), area.width, stencil.span(area.x, y1));
+    }
+  });
+}
+#pragma endregion Draw
+} // namespace Mova
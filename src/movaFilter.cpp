@@ -0,0 +1,173 @@
+#include "lib/OreonMath.hpp"
+#include "lib/logassert.h"
+#include "movaImage.hpp"
+#include "movaKernels.hpp"
+#include <cmath>
+
+/*
+--- Color filters ---
+A color matrix is rewritten once per call for the byte order of the source and destination pixels, so the per pixel loop
+reads packed bytes and writes packed bytes without swaps, and has no branches to keep it vectorizable. Matrices that only
+scale and offset each channel (brightness, contrast, tint) become 256-entry tables instead
+*/
+
+using namespace VectorMath;
+
+namespace Mova {
+#pragma region ColorMatrix
+// Rec. 709 luminance weights
+static constexpr float lumaR = 0.2126f, lumaG = 0.7152f, lumaB = 0.0722f;
+
+ColorMatrix ColorMatrix::operator*(const ColorMatrix& other) const {
+  ColorMatrix result;
+  for (uint32_t row = 0; row < 4; row++) {
+    for (uint32_t column = 0; column < 5; column++) {
+      float sum = column == 4 ? (*this)(row, 4) : 0;
+      for (uint32_t k = 0; k < 4; k++) sum += (*this)(row, k) * other(k, column);
+      result(row, column) = sum;
+    }
+  }
+  return result;
+}
+
+ColorMatrix ColorMatrix::brightness(float amount) {
+  ColorMatrix matrix;
+  for (uint32_t row = 0; row < 3; row++) matrix(row, 4) = amount;
+  return matrix;
+}
+
+ColorMatrix ColorMatrix::contrast(float amount) {
+  ColorMatrix matrix;
+  for (uint32_t row = 0; row < 3; row++) matrix(row, row) = amount, matrix(row, 4) = 0.5f * (1 - amount);
+  return matrix;
+}
+
+ColorMatrix ColorMatrix::saturation(float amount) {
+  ColorMatrix matrix;
+  const float luma[3] = {lumaR, lumaG, lumaB};
+  for (uint32_t row = 0; row < 3; row++)
+    for (uint32_t column = 0; column < 3; column++) matrix(row, column) = (1 - amount) * luma[column] + (row == column ? amount : 0);
+  return matrix;
+}
+
+ColorMatrix ColorMatrix::hueRotation(float angle) {
+  // SVG's feColorMatrix hueRotate: a rotation around the gray axis, corrected so luminance is kept
+  const float c = cosf(angle), s = sinf(angle);
+  ColorMatrix matrix;
+  matrix.m = {0.213f + c * 0.787f - s * 0.213f, 0.715f - c * 0.715f - s * 0.715f, 0.072f - c * 0.072f + s * 0.928f, 0, 0,
+              0.213f - c * 0.213f + s * 0.143f, 0.715f + c * 0.285f + s * 0.140f, 0.072f - c * 0.072f - s * 0.283f, 0, 0,
+              0.213f - c * 0.213f - s * 0.787f, 0.715f - c * 0.715f + s * 0.715f, 0.072f + c * 0.928f + s * 0.072f, 0, 0,
+              0,                                0,                                0,                                1, 0};
+  return matrix;
+}
+
+ColorMatrix ColorMatrix::tint(Color color, float amount) {
+  ColorMatrix matrix;
+  const uint8_t channels[4] = {color.r, color.g, color.b, color.a};
+  for (uint32_t row = 0; row < 4; row++) matrix(row, row) = 1 + amount * (channels[row] / 255.f - 1);
+  return matrix;
+}
+#pragma endregion ColorMatrix
+
+#pragma region Filter
+// * Color matrix over packed bytes: output byte o is k[o][0..3] times the input bytes plus k[o][4], all in 0 to 255
+struct PackedMatrix {
+  float k[4][5];
+};
+
+// Byte of each RGBA channel in a built-in pixel format
+static void channelBytes(PixelFormat format, uint32_t (&bytes)[4]) {
+  const bool swapped = format == PixelFormat::BGRA;
+  bytes[0] = swapped ? 2 : 0, bytes[1] = 1, bytes[2] = swapped ? 0 : 2, bytes[3] = 3;
+}
+
+static PackedMatrix packMatrix(const ColorMatrix& matrix, PixelFormat from, PixelFormat to) {
+  uint32_t input[4], output[4];
+  channelBytes(from, input), channelBytes(to, output);
+  PackedMatrix packed;
+  for (uint32_t row = 0; row < 4; row++) {
+    for (uint32_t column = 0; column < 4; column++) packed.k[output[row]][input[column]] = matrix(row, column);
+    packed.k[output[row]][4] = matrix(row, 4) * 255;
+  }
+  return packed;
+}
+
+static inline uint32_t toByte(float value) { return static_cast<uint32_t>(Math::clamp(value, 0.f, 255.f) + 0.5f); }
+
+// src and dst may be the same row
+static void matrixRow(const uint32_t* src, uint32_t* dst, uint32_t width, const PackedMatrix& matrix) {
+  const PackedMatrix k = matrix;
+  for (uint32_t x = 0; x < width; x++) {
+    const float c0 = src[x] & 0xFF, c1 = (src[x] >> 8) & 0xFF, c2 = (src[x] >> 16) & 0xFF, c3 = src[x] >> 24;
+    const float o0 = k.k[0][0] * c0 + k.k[0][1] * c1 + k.k[0][2] * c2 + k.k[0][3] * c3 + k.k[0][4];
+    const float o1 = k.k[1][0] * c0 + k.k[1][1] * c1 + k.k[1][2] * c2 + k.k[1][3] * c3 + k.k[1][4];
+    const float o2 = k.k[2][0] * c0 + k.k[2][1] * c1 + k.k[2][2] * c2 + k.k[2][3] * c3 + k.k[2][4];
+    const float o3 = k.k[3][0] * c0 + k.k[3][1] * c1 + k.k[3][2] * c2 + k.k[3][3] * c3 + k.k[3][4];
+    dst[x] = toByte(o0) | toByte(o1) << 8 | toByte(o2) << 16 | toByte(o3) << 24;
+  }
+}
+
+static void tableRow(const uint32_t* src, uint32_t* dst, uint32_t width, const uint32_t (&tables)[4][256]) {
+  for (uint32_t x = 0; x < width; x++) {
+    const uint32_t pixel = src[x];
+    dst[x] = tables[0][pixel & 0xFF] | tables[1][(pixel >> 8) & 0xFF] | tables[2][(pixel >> 16) & 0xFF] | tables[3][pixel >> 24];
+  }
+}
+
+static void applyMatrix(const Image& from, Image& to, const ColorMatrix& matrix) {
+  MV_ASSERT(from.data(), "Cannot apply color matrix: Image data is null!");
+  const uint32_t width = from.width();
+  // Custom formats go through Color both ways
+  if (from.pixelFormat() == PixelFormat::Custom || to.pixelFormat() == PixelFormat::Custom) {
+    const PackedMatrix packed = packMatrix(matrix, PixelFormat::RGBA, PixelFormat::RGBA);
+    Kernels::parallelFor(from.height(), 64, [&](uint32_t begin, uint32_t end) {
+      // Every band's own, so it lives on the thread running it
+      static thread_local std::vector<uint32_t> line;
+      line.resize(width);
+      for (uint32_t y = begin; y < end; y++) {
+        for (uint32_t x = 0; x < width; x++) line[x] = from.unpack(from.row(y)[x]).value;
+        matrixRow(line.data(), line.data(), width, packed);
+        for (uint32_t x = 0; x < width; x++) to.row(y)[x] = to.pack(Color(line[x]));
+      }
+    });
+    return;
+  }
+
+  const PackedMatrix packed = packMatrix(matrix, from.pixelFormat(), to.pixelFormat());
+  bool diagonal = true;
+  for (uint32_t o = 0; o < 4; o++)
+    for (uint32_t i = 0; i < 4; i++) diagonal = diagonal && (o == i || packed.k[o][i] == 0);
+  if (diagonal) {
+    uint32_t tables[4][256];
+    for (uint32_t o = 0; o < 4; o++)
+      for (uint32_t i = 0; i < 256; i++) tables[o][i] = toByte(packed.k[o][o] * i + packed.k[o][4]) << (o * 8);
+    Kernels::parallelFor(from.height(), 64, [&](uint32_t begin, uint32_t end) {
+      for (uint32_t y = begin; y < end; y++) tableRow(from.row(y), to.row(y), width, tables);
+    });
+    return;
+  }
+  Kernels::parallelFor(from.height(), 64, [&](uint32_t begin, uint32_t end) {
+    for (uint32_t y = begin; y < end; y++) matrixRow(from.row(y), to.row(y), width, packed);
+  });
+}
+
+/**
+ * @brief Filter every pixel through a color matrix, in place. Rows are filtered on separate threads
+ *
+ * @param matrix Color matrix, see the ColorMatrix helpers
+ */
+void Image::applyColorMatrix(const ColorMatrix& matrix) { applyMatrix(*this, *this, matrix); }
+
+/**
+ * @brief Filter every pixel through a color matrix into another image. Rows are filtered on separate threads
+ *
+ * @param matrix Color matrix, see the ColorMatrix helpers
+ * @param destination Receives the result. It is resized to this image's size and keeps its pixel format
+ */
+void Image::applyColorMatrix(const ColorMatrix& matrix, Image& destination) const {
+  MV_ASSERT(&destination != this, "Use the in place applyColorMatrix to filter an image into itself!");
+  destination.setSize(size());
+  applyMatrix(*this, destination, matrix);
+}
+#pragma endregion Filter
+} // namespace Mova
@@ -0,0 +1,172 @@
+#include "lib/OreonMath.hpp"
+#include "lib/logassert.h"
+#include "movaImage.hpp"
+#include "movaKernels.hpp"
+#include <cmath>
+
+/*
+--- Gradient paint ---
+Stops are baked once into a 256-entry table, so shading a pixel is one position step, a spread fold and a table lookup.
+The position along the gradient is linear in x for linear gradients and stepped incrementally along each span
+*/
+
+using namespace VectorMath;
+
+namespace Mova {
+#pragma region Gradient
+Gradient::Gradient(Type type, vec2f start, vec2f end, float radius, std::vector<GradientStop> stops) : m_Type(type), m_Start(start), m_End(end), m_Radius(radius) {
+  MV_ASSERT(!stops.empty(), "Gradient needs at least one stop!");
+  if (stops.empty()) stops.push_back(GradientStop{0, Color(0, 0, 0, 0)});
+  for (GradientStop& stop : stops) stop.offset = Math::clamp(stop.offset, 0.f, 1.f);
+  std::stable_sort(stops.begin(), stops.end(), [](const GradientStop& a, const GradientStop& b) { return a.offset < b.offset; });
+
+  // Interpolate premultiplied, so fading into a transparent stop doesn't drag in the transparent stop's color
+  size_t next = 0;
+  for (uint32_t i = 0; i < 256; i++) {
+    const float t = i / 255.f;
+    while (next < stops.size() && stops[next].offset < t) next++;
+    const GradientStop& from = stops[next == 0 ? 0 : next - 1];
+    const GradientStop& to = stops[Math::min(next, stops.size() - 1)];
+    const float span = to.offset - from.offset;
+    const float f = span > 0 ? Math::clamp((t - from.offset) / span, 0.f, 1.f) : (t < to.offset ? 0.f : 1.f);
+    const float fromAlpha = from.color.a / 255.f, toAlpha = to.color.a / 255.f;
+    const float alpha = fromAlpha + (toAlpha - fromAlpha) * f;
+    const float channels[3] = {
+        from.color.r * fromAlpha + (to.color.r * toAlpha - from.color.r * fromAlpha) * f,
+        from.color.g * fromAlpha + (to.color.g * toAlpha - from.color.g * fromAlpha) * f,
+        from.color.b * fromAlpha + (to.color.b * toAlpha - from.color.b * fromAlpha) * f,
+    };
+    uint16_t* wide = &m_WideTable[i * 4];
+    for (uint32_t c = 0; c < 3; c++) wide[c] = static_cast<uint16_t>(Math::clamp(alpha > 0 ? channels[c] / alpha * 256.f : 0.f, 0.f, 255.f * 256.f));
+    wide[3] = static_cast<uint16_t>(alpha * 255.f * 256.f);
+    m_Table[i] = Color((wide[0] + 128) >> 8, (wide[1] + 128) >> 8, (wide[2] + 128) >> 8, (wide[3] + 128) >> 8);
+  }
+}
+#pragma endregion Gradient
+
+#pragma region Shader
+namespace Kernels {
+// 4x4 Bayer matrix scaled to 8.8 thresholds
+static const uint8_t bayer[4][4] = {
+    {8, 136, 40, 168},
+    {200, 72, 232, 104},
+    {56, 184, 24, 152},
+    {248, 120, 216, 88},
+};
+
+GradientShader::GradientShader(const Gradient& gradient, const Image& image) : m_Gradient(gradient), m_Image(image), m_ToGradient(image.transform().inverse()) {
+  for (uint32_t i = 0; i < 256; i++) m_Packed[i] = image.pack(gradient.table()[i]);
+}
+
+float GradientShader::position(float t) const {
+  switch (m_Gradient.spread()) {
+  case GradientSpread::Pad: return Math::clamp(t, 0.f, 1.f);
+  case GradientSpread::Repeat: return t - floorf(t);
+  case GradientSpread::Reflect: {
+    const float folded = t - 2 * floorf(t * 0.5f);
+    return folded > 1 ? 2 - folded : folded;
+  }
+  }
+  return t;
+}
+
+void GradientShader::shade(int32_t x, int32_t y, uint32_t count, uint32_t* out) const {
+  // Gradient position of every pixel center in the span, scaled to the table
+  static thread_local std::vector<float> positions;
+  if (positions.size() < count) positions.resize(count);
+  // Affine maps keep the position linear along the span, so it only needs the pixel center mapped once and a step
+  const vec2f p = m_ToGradient * vec2f(x + 0.5f, y + 0.5f) - m_Gradient.start(), step = m_ToGradient.transformVector(vec2f(1, 0));
+  if (m_Gradient.type() == Gradient::Type::Linear) {
+    const vec2f axis = m_Gradient.end() - m_Gradient.start();
+    const float length2 = axis.sqrMagnitude();
+    const float scale = length2 > 0 ? 1 / length2 : 0;
+    const float t0 = p.dot(axis) * scale, dt = step.dot(axis) * scale;
+    for (uint32_t i = 0; i < count; i++) positions[i] = t0 + dt * i;
+  } else {
+    const float scale = m_Gradient.radius() > 0 ? 1 / m_Gradient.radius() : 0;
+    const vec2f d = p * scale, dd = step * scale;
+    for (uint32_t i = 0; i < count; i++) {
+      const float ix = d.x + dd.x * i, iy = d.y + dd.y * i;
+      positions[i] = sqrtf(ix * ix + iy * iy);
+    }
+  }
+  if (m_Gradient.spread() == GradientSpread::Pad) {
+    for (uint32_t i = 0; i < count; i++) positions[i] = Math::clamp(positions[i], 0.f, 1.f) * 255.f;
+  } else {
+    for (uint32_t i = 0; i < count; i++) positions[i] = position(positions[i]) * 255.f;
+  }
+
+  if (!m_Gradient.dither()) {
+    for (uint32_t i = 0; i < count; i++) out[i] = m_Packed[static_cast<uint32_t>(positions[i] + 0.5f)];
+    return;
+  }
+
+  // Interpolate the wide table between entries and let the threshold pick the rounding direction
+  const uint16_t* wide = m_Gradient.wideTable().data();
+  const uint8_t* thresholds = bayer[y & 3];
+  const PixelFormat format = m_Image.pixelFormat();
+  for (uint32_t i = 0; i < count; i++) {
+    const uint32_t index = Math::min(static_cast<uint32_t>(positions[i]), 254u);
+    const uint32_t f = static_cast<uint32_t>((positions[i] - index) * 256.f);
+    const uint16_t *a = wide + index * 4, *b = a + 4;
+    const uint32_t threshold = thresholds[(x + i) & 3];
+    uint8_t channels[4];
+    for (uint32_t c = 0; c < 4; c++) channels[c] = static_cast<uint8_t>(Math::min((a[c] + ((static_cast<int32_t>(b[c]) - a[c]) * static_cast<int32_t>(f) >> 8) + threshold) >> 8, 255u));
+    const Color color(channels[0], channels[1], channels[2], channels[3]);
+    if (format == PixelFormat::RGBA) out[i] = color.value;
+    else if (format == PixelFormat::BGRA) out[i] = swapRB(color.value);
+    else out[i] = m_Image.pack(color);
+  }
+}
+} // namespace Kernels
+#pragma endregion Shader
+
+#pragma region Fill
+/**
+ * @brief Fill a rectangle with a gradient
+ *
+ * @param x X position
+ * @param y Y position
+ * @param width Width, may be negative
+ * @param height Height, may be negative
+ * @param gradient Gradient paint, in the same coordinates as the shape
+ */
+void Image::fillRect(int32_t x, int32_t y, int32_t width, int32_t height, const Gradient& gradient) {
+  MV_ASSERT(m_Data, "Cannot fill: Image data is null!");
+  if (width < 0) x += width, width = -width;
+  if (height < 0) y += height, height = -height;
+  Rect<int32_t> area(x, y, width, height);
+  if (m_HasTransform) {
+    if (!m_Transform.isAxisAligned()) {
+      static thread_local Path path;
+      path.clear();
+      fillPath(path.rect(area), gradient);
+      return;
+    }
+    const vec2i from = round(m_Transform * vec2f(x, y)), to = round(m_Transform * vec2f(x + width, y + height));
+    area = Rect<int32_t>(from, to - from);
+  }
+  if (!clip(area)) return;
+  const int32_t x0 = area.left(), y0 = area.top(), x1 = area.right(), y1 = area.bottom();
+
+  const Kernels::GradientShader shader(gradient, *this);
+  static thread_local std::vector<uint32_t> colors;
+  colors.resize(x1 - x0);
+  // A vertical linear gradient is constant along a row, so it is shaded once per row and filled
+  const bool rowConstant = gradient.type() == Gradient::Type::Linear && gradient.start().x == gradient.end().x && !gradient.dither();
+  const Kernels::Stencil stencil(*this);
+  Kernels::withBlendMode(m_BlendMode, [&](auto mode) {
+    using Mode = decltype(mode);
+    for (int32_t row = y0; row < y1; row++) {
+      if (rowConstant) {
+        shader.shade(x0, row, 1, colors.data());
+        Kernels::fillSpan<Mode>(this->row(row) + x0, x1 - x0, colors[0], stencil.span(x0, row));
+        continue;
+      }
+      shader.shade(x0, row, x1 - x0, colors.data());
+      Kernels::blendSpan<Mode>(this->row(row) + x0, colors.data(), x1 - x0, stencil.span(x0, row));
+    }
+  });
+}
+#pragma endregion Fill
+} // namespace Mova
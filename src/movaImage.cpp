@@ -1,6 +1,7 @@
 #include "lib/OreonMath.hpp"
 #include "lib/logassert.h"
 #include <codecvt>
+#include <cstring>
 #include <fstream>
 #include <locale>
 #include <stdint.h>
@@ -8,11 +9,11 @@
 
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_TRUETYPE_IMPLEMENTATION
-// #define STB_RECT_PACK_IMPLEMENTATION
+#define STB_RECT_PACK_IMPLEMENTATION
 
 #include "movaImage.hpp"
+#include "movaKernels.hpp"
 #include <lib/stb_image.h>
-// #include <lib/stb_rect_pack.h>
 
 namespace Mova {
 const Color Color::black = Color(0, 0, 0), Color::white = Color(255, 255, 255),
@@ -47,6 +48,44 @@ Color Color::hsv(uint16_t hue, uint8_t saturation, uint8_t value,
   return Color((r + m) * 255, (g + m) * 255, (b + m) * 255, alpha);
 }
 
+/**
+ * @brief Convert a batch of HSV colors, like the hues of a palette. Every
+ * color equals the one hsv(hue, saturation, value, alpha) returns, but the
+ * loop picks channels without branches or fmod, so it vectorizes
+ *
+ * @param hue Hues in degrees
+ * @param saturation Saturations, 0 to 100
+ * @param value Values, 0 to 100
+ * @param out Receives the colors
+ * @param count Number of colors
+ * @param alpha Alpha of every color
+ */
+void Color::hsv(const uint16_t *hue, const uint8_t *saturation,
+                const uint8_t *value, Color *out, size_t count,
+                uint8_t alpha) {
+  for (size_t i = 0; i < count; i++) {
+    const uint32_t h = hue[i] % 360, sector = h / 60;
+    const float s = Math::min<uint32_t>(saturation[i], 100) / 100.f;
+    const float v = Math::min<uint32_t>(value[i], 100) / 100.f;
+    const float C = s * v;
+    // fmod(t, 2) by subtracting the even part, which is exact
+    const float t = h / 60.f;
+    const float X =
+        C * (1 - Math::abs(t - (static_cast<int32_t>(t) & ~1) - 1.0));
+    const float m = v - C;
+    const float r = sector == 0 || sector == 5   ? C
+                    : sector == 1 || sector == 4 ? X
+                                                 : 0;
+    const float g = sector == 1 || sector == 2   ? C
+                    : sector == 0 || sector == 3 ? X
+                                                 : 0;
+    const float b = sector == 3 || sector == 4   ? C
+                    : sector == 2 || sector == 5 ? X
+                                                 : 0;
+    out[i] = Color((r + m) * 255, (g + m) * 255, (b + m) * 255, alpha);
+  }
+}
+
 #pragma region Font
 Font::Font(const std::map<std::string_view, std::vector<Range>> &fonts,
            uint32_t lineHeight)
@@ -132,8 +171,8 @@ Font::Font(const std::map<std::string_view, std::vector<Range>> &fonts,
   // Pack rects
   stbtt_PackFontRangesPackRects(&packContext, rects, totalRects);
 
+  VectorMath::vec2u atlasSize = 0;
   { // Determine atlas size
-    atlasSize = 0;
     uint32_t rectIndex = 0;
     for (auto &range : m_Ranges) {
       for (uint32_t i = 0; i < range.num_chars; i++) {
@@ -149,9 +188,9 @@ Font::Font(const std::map<std::string_view, std::vector<Range>> &fonts,
   }
 
   // Pass 3 - render atlas
-  atlas = new uint8_t[atlasSize.x * atlasSize.y];
-  packContext.pixels = atlas;
-  packContext.stride_in_bytes = atlasSize.x;
+  atlas.setSize(atlasSize);
+  packContext.pixels = atlas.data();
+  packContext.stride_in_bytes = atlas.width();
 
   for (auto &[info, databuffer, rangeOffset, rangeCount, rectOffset] : datas) {
     MV_ASSERT(stbtt_PackFontRangesRenderIntoRects(
@@ -165,8 +204,6 @@ Font::Font(const std::map<std::string_view, std::vector<Range>> &fonts,
 }
 
 Font::~Font() {
-  if (atlas)
-    delete[] atlas;
   for (auto &range : m_Ranges) {
     delete[] range.chardata_for_range;
   }
@@ -206,52 +243,376 @@ Color reverseColorModeBGR(uint32_t color) {
 }
 
 Image::Image(uint32_t width, uint32_t height, const uint8_t *data)
-    : m_Width(width), m_Height(height) {
-  m_Data = new uint8_t[width * height * 4];
+    : m_Width(width), m_Height(height), m_Stride(width * sizeof(uint32_t)) {
+  const size_t bytes = static_cast<size_t>(width) * height * sizeof(uint32_t);
+  m_Data = m_Allocator->allocate(bytes, m_Capacity);
   if (data)
-    std::copy(data, data + width * height * sizeof(uint32_t), m_Data);
+    std::memcpy(m_Data, data, bytes);
   else
-    std::fill(m_Data, m_Data + width * height * sizeof(uint32_t),
-              Color::transperent.value);
+    std::memset(m_Data, 0, bytes);
 }
 
 Image::Image(std::string_view path) {
   int x = 0, y = 0, n = 0;
   unsigned char *data = ::stbi_load(std::string(path).c_str(), &x, &y, &n, 4);
   MV_ASSERT(data, "Could not load image: %s", std::string(path).c_str());
-  m_Data = new uint8_t[x * y * 4];
-  std::copy(data, data + x * y * sizeof(uint32_t), m_Data);
+  m_Width = x;
+  m_Height = y;
+  m_Stride = x * sizeof(uint32_t);
+  const size_t bytes = static_cast<size_t>(x) * y * sizeof(uint32_t);
+  m_Data = m_Allocator->allocate(bytes, m_Capacity);
+  std::memcpy(m_Data, data, bytes);
   ::stbi_image_free(reinterpret_cast<void *>(data));
 }
 
+Image Image::wrap(uint32_t width, uint32_t height, uint8_t *data,
+                  uint32_t stride, PixelFormat format) {
+  Image image;
+  image.attach(width, height, data, stride, format);
+  return image;
+}
+
+void Image::attach(uint32_t width, uint32_t height, uint8_t *data,
+                   uint32_t stride, PixelFormat format) {
+  MV_ASSERT(data, "Cannot wrap null memory!");
+  if (stride == 0)
+    stride = width * sizeof(uint32_t);
+  MV_ASSERT(stride >= width * sizeof(uint32_t),
+            "Stride %u is too small for width %u!", stride, width);
+  if (m_Data && !m_External)
+    m_Allocator->deallocate(m_Data, m_Capacity);
+  m_Data = data;
+  m_Width = width;
+  m_Height = height;
+  m_Stride = stride;
+  m_Capacity = 0;
+  m_External = true;
+  setPixelFormat(format);
+}
+
+Image &Image::operator=(const Image &other) {
+  if (this == &other)
+    return *this;
+  if (!other.m_Data) {
+    // Empty source: drop the pixels (or the wrapped memory), keep the
+    // drawing state
+    if (m_Data && !m_External)
+      m_Allocator->deallocate(m_Data, m_Capacity);
+    m_Data = nullptr;
+    m_Width = m_Height = m_Stride = 0;
+    m_Capacity = 0;
+    m_External = false;
+  } else {
+    setSize(other.size());
+    for (uint32_t y = 0; y < m_Height; y++)
+      std::memcpy(row(y), other.row(y), m_Width * sizeof(uint32_t));
+  }
+  colorMode = other.colorMode;
+  reverseColorMode = other.reverseColorMode;
+  m_Format = other.m_Format;
+  font = other.font;
+  return *this;
+}
+
+void Image::swap(Image &other) noexcept {
+  std::swap(colorMode, other.colorMode);
+  std::swap(reverseColorMode, other.reverseColorMode);
+  std::swap(m_Data, other.m_Data);
+  std::swap(m_Width, other.m_Width);
+  std::swap(m_Height, other.m_Height);
+  std::swap(m_Stride, other.m_Stride);
+  std::swap(m_Capacity, other.m_Capacity);
+  std::swap(m_External, other.m_External);
+  std::swap(m_Format, other.m_Format);
+  std::swap(m_Allocator, other.m_Allocator);
+  std::swap(font, other.font);
+  std::swap(m_ClipStack, other.m_ClipStack);
+  std::swap(m_Transform, other.m_Transform);
+  std::swap(m_TransformStack, other.m_TransformStack);
+  std::swap(m_HasTransform, other.m_HasTransform);
+  std::swap(m_BlendMode, other.m_BlendMode);
+  m_Stencil.swap(other.m_Stencil);
+  std::swap(m_StencilMode, other.m_StencilMode);
+}
+
+void Image::setPixelFormat(PixelFormat format) {
+  MV_ASSERT(format != PixelFormat::Custom,
+            "Use setColorMode for custom color modes!");
+  if (format == PixelFormat::RGBA)
+    colorMode = colorModeRGB, reverseColorMode = reverseColorModeRGB;
+  else
+    colorMode = colorModeBGR, reverseColorMode = reverseColorModeBGR;
+  m_Format = format;
+}
+
+void Image::setAllocator(ImageAllocator &allocator) {
+  if (&allocator == m_Allocator)
+    return;
+  if (m_Data && !m_External) {
+    const size_t bytes =
+        static_cast<size_t>(m_Width) * m_Height * sizeof(uint32_t);
+    size_t capacity = 0;
+    uint8_t *newData = allocator.allocate(bytes, capacity);
+    std::memcpy(newData, m_Data, bytes);
+    m_Allocator->deallocate(m_Data, m_Capacity);
+    m_Data = newData;
+    m_Capacity = capacity;
+  }
+  m_Allocator = &allocator;
+}
+
 void Image::setSize(uint32_t width, uint32_t height) {
   if (width == m_Width && height == m_Height)
     return;
   MV_ASSERT(width > 0 && height > 0, "Invalid image size: %u%%%u", width,
             height);
-  uint8_t *newData = new uint8_t[width * height * 4];
-  if (m_Data) {
-    uint32_t minW = Math::min(m_Width, width),
-             minH = Math::min(m_Height, height);
-    for (uint32_t x = 0; x < minW; x++) {
-      for (uint32_t y = 0; y < minH; y++) {
-        reinterpret_cast<uint32_t *>(newData)[x + y * width] =
-            reinterpret_cast<uint32_t *>(m_Data)[x + y * m_Width];
-      }
+  MV_ASSERT(!m_External, "Cannot resize an image over foreign memory!");
+  const size_t bytes = static_cast<size_t>(width) * height * sizeof(uint32_t);
+  const size_t oldPitch = m_Stride,
+               newPitch = width * sizeof(uint32_t);
+  const size_t rowBytes = Math::min(m_Width, width) * sizeof(uint32_t);
+  const uint32_t rows = Math::min(m_Height, height);
+
+  if (m_Data && bytes <= m_Capacity) {
+    // Repack rows in place. A wider pitch moves rows forward, so walk
+    // bottom-up to read each row before it gets overwritten
+    if (newPitch > oldPitch) {
+      for (uint32_t y = rows; y-- > 1;)
+        std::memmove(m_Data + y * newPitch, m_Data + y * oldPitch, rowBytes);
+    } else if (newPitch < oldPitch) {
+      for (uint32_t y = 1; y < rows; y++)
+        std::memmove(m_Data + y * newPitch, m_Data + y * oldPitch, rowBytes);
     }
+  } else {
+    // Leave headroom when an existing buffer grows, so an interactive
+    // resize doesn't reallocate on every frame
+    size_t capacity = 0;
+    uint8_t *newData = m_Allocator->allocate(
+        m_Data ? Math::max(bytes, m_Capacity + m_Capacity / 2) : bytes,
+        capacity);
+    if (m_Data) {
+      for (uint32_t y = 0; y < rows; y++)
+        std::memcpy(newData + y * newPitch, m_Data + y * oldPitch, rowBytes);
+      m_Allocator->deallocate(m_Data, m_Capacity);
+    }
+    m_Data = newData;
+    m_Capacity = capacity;
   }
-  delete[] m_Data;
   m_Width = width;
   m_Height = height;
-  m_Data = newData;
+  m_Stride = newPitch;
+}
+
+void Image::clear(Color color) {
+  MV_ASSERT(m_Data, "Cannot clear: Image data is null!");
+  const uint32_t c = colorMode(color);
+  for (uint32_t y = 0; y < m_Height; y++)
+    std::fill(row(y), row(y) + m_Width, c);
+}
+
+void Image::setStencilMode(StencilMode mode) {
+  m_StencilMode = mode;
+  if (mode != StencilMode::Off)
+    stencil();
+}
+
+Mask &Image::stencil() {
+  MV_ASSERT(m_Data, "Cannot use the stencil: Image data is null!");
+  if (m_Stencil.size() != size())
+    m_Stencil.setSize(m_Width, m_Height);
+  return m_Stencil;
 }
 
 #pragma endregion ImageCanvas
+#pragma region Mask
+Mask::Mask(uint32_t width, uint32_t height, const uint8_t *data)
+    : m_Width(width), m_Height(height) {
+  const size_t bytes = static_cast<size_t>(width) * height;
+  m_Data = m_Allocator->allocate(bytes, m_Capacity);
+  if (data)
+    std::memcpy(m_Data, data, bytes);
+  else
+    std::memset(m_Data, 0, bytes);
+}
+
+Mask &Mask::operator=(const Mask &other) {
+  if (this == &other)
+    return *this;
+  if (!other.m_Data) {
+    Mask().swap(*this);
+    return *this;
+  }
+  setSize(other.size());
+  std::memcpy(m_Data, other.m_Data,
+              static_cast<size_t>(m_Width) * m_Height);
+  return *this;
+}
+
+void Mask::swap(Mask &other) noexcept {
+  std::swap(m_Data, other.m_Data);
+  std::swap(m_Width, other.m_Width);
+  std::swap(m_Height, other.m_Height);
+  std::swap(m_Capacity, other.m_Capacity);
+  std::swap(m_Allocator, other.m_Allocator);
+}
+
+void Mask::setSize(uint32_t width, uint32_t height) {
+  MV_ASSERT(width > 0 && height > 0, "Invalid mask size: %u%%%u", width,
+            height);
+  const size_t bytes = static_cast<size_t>(width) * height;
+  if (!m_Data || bytes > m_Capacity) {
+    if (m_Data)
+      m_Allocator->deallocate(m_Data, m_Capacity);
+    m_Data = m_Allocator->allocate(bytes, m_Capacity);
+  }
+  m_Width = width;
+  m_Height = height;
+  std::memset(m_Data, 0, bytes);
+}
+
+void Mask::clear(uint8_t value) {
+  MV_ASSERT(m_Data, "Cannot clear: Mask data is null!");
+  std::memset(m_Data, value, static_cast<size_t>(m_Width) * m_Height);
+}
+#pragma endregion Mask
+#pragma region Transform
+/**
+ * @brief Make the drawing primitives work in transformed coordinates until
+ * the matching popTransform
+ *
+ * @param transform Affine transform, applied before the current one
+ */
+void Image::pushTransform(const VectorMath::mat3f &transform) {
+  MV_ASSERT(transform.isAffine(), "Cannot pushTransform: Only affine transforms are supported!");
+  m_TransformStack.push_back(m_Transform);
+  m_Transform *= transform;
+  m_HasTransform = !m_Transform.isIdentity();
+}
+
+/**
+ * @brief Restore the transform from before the last pushTransform
+ */
+void Image::popTransform() {
+  MV_ASSERT(!m_TransformStack.empty(), "Cannot popTransform: Transform stack is empty!");
+  if (m_TransformStack.empty())
+    return;
+  m_Transform = m_TransformStack.back();
+  m_TransformStack.pop_back();
+  m_HasTransform = !m_Transform.isIdentity();
+}
+
+void Image::resetTransform() {
+  m_TransformStack.clear();
+  m_Transform = VectorMath::mat3f();
+  m_HasTransform = false;
+}
+
+static VectorMath::Rect<int32_t> normalized(VectorMath::Rect<int32_t> rect) {
+  if (rect.width < 0)
+    rect.x += rect.width, rect.width = -rect.width;
+  if (rect.height < 0)
+    rect.y += rect.height, rect.height = -rect.height;
+  return rect;
+}
+
+// * Pixel bounds of a rect mapped through a transform. Axis-aligned transforms
+// round the edges, so they keep sharing pixel boundaries with neighbouring rects
+static VectorMath::Rect<int32_t> mapBounds(const VectorMath::mat3f &transform,
+                                           VectorMath::Rect<float> rect) {
+  if (transform.isIdentity())
+    return rect;
+  const VectorMath::vec2f corners[4] = {
+      transform * rect.tl(), transform * rect.tr(), transform * rect.br(),
+      transform * rect.bl()};
+  VectorMath::vec2f minP = corners[0], maxP = corners[0];
+  for (const VectorMath::vec2f &corner : corners)
+    minP = VectorMath::min(minP, corner), maxP = VectorMath::max(maxP, corner);
+  const VectorMath::vec2i from = transform.isAxisAligned()
+                                     ? VectorMath::round(minP)
+                                     : VectorMath::floor(minP);
+  const VectorMath::vec2i to = transform.isAxisAligned()
+                                   ? VectorMath::round(maxP)
+                                   : VectorMath::ceil(maxP);
+  return VectorMath::Rect<int32_t>(from, to - from);
+}
+
+// * Maps a transformed image's pixel centers to the source rect of
+// drawImage-style calls. A mirrored axis reads the source backwards
+static VectorMath::mat3f toSource(const VectorMath::mat3f &transform,
+                                  VectorMath::Rect<float> rect, bool mirrorX,
+                                  bool mirrorY,
+                                  VectorMath::Rect<float> source) {
+  const float sx = source.width / rect.width, sy = source.height / rect.height;
+  const VectorMath::mat3f rectToSource(
+      mirrorX ? -sx : sx, 0,
+      mirrorX ? source.right() + rect.x * sx : source.x - rect.x * sx, 0,
+      mirrorY ? -sy : sy,
+      mirrorY ? source.bottom() + rect.y * sy : source.y - rect.y * sy);
+  return rectToSource * transform.inverse();
+}
+
+static VectorMath::vec2f *quadCorners(const VectorMath::mat3f &transform,
+                                      VectorMath::Rect<float> rect,
+                                      VectorMath::vec2f (&corners)[4]) {
+  corners[0] = transform * rect.tl(), corners[1] = transform * rect.tr();
+  corners[2] = transform * rect.br(), corners[3] = transform * rect.bl();
+  return corners;
+}
+#pragma endregion Transform
+#pragma region Clip
+
+/**
+ * @brief Restrict drawing to a rectangle until the matching popClip. Nested
+ * clips intersect
+ *
+ * @param rect Clip rectangle, in pixels
+ */
+void Image::pushClip(VectorMath::Rect<int32_t> rect) {
+  rect = mapBounds(m_Transform, normalized(rect));
+  if (!m_ClipStack.empty())
+    rect = rect.intersection(m_ClipStack.back());
+  m_ClipStack.push_back(rect);
+}
+
+/**
+ * @brief Remove the innermost clip rectangle
+ */
+void Image::popClip() {
+  MV_ASSERT(!m_ClipStack.empty(), "Cannot popClip: Clip stack is empty!");
+  if (!m_ClipStack.empty())
+    m_ClipStack.pop_back();
+}
+
+/**
+ * @brief The area primitives currently draw into: the innermost clip
+ * rectangle, intersected with the image bounds
+ */
+VectorMath::Rect<int32_t> Image::clipRect() const {
+  const VectorMath::Rect<int32_t> bounds(0, 0, m_Width, m_Height);
+  if (m_ClipStack.empty())
+    return bounds;
+  return m_ClipStack.back().intersection(bounds);
+}
+
+/**
+ * @brief Shared pre-clip step of the primitives
+ *
+ * @param rect Area about to be drawn, clipped in place. A negative size is
+ * normalized first
+ * @return false when nothing is left to draw
+ */
+bool Image::clip(VectorMath::Rect<int32_t> &rect) const {
+  rect = normalized(rect);
+  if (rect.width == 0 || rect.height == 0)
+    return false;
+  rect = rect.intersection(clipRect());
+  return rect.width > 0 && rect.height > 0;
+}
+#pragma endregion Clip
 #pragma region DrawPixel
 void Image::setPixel(int32_t x, int32_t y, Color color) {
   MV_ASSERT(m_Data, "Cannot set pixel: Image data is null!");
-  if (!Math::inRange<int32_t>(x, 0, m_Width) ||
-      !Math::inRange<int32_t>(y, 0, m_Height))
+  if (!clipRect().contains(VectorMath::vec2i(x, y)))
     return;
   set(x, y, color);
 }
@@ -265,45 +626,106 @@ Color Image::getPixel(int32_t x, int32_t y) const {
 }
 #pragma endregion DrawPixel
 #pragma region Draw
-static Color alphaBlend(Color a, Color b) {
-  b.r = Math::lerp(a.r, b.r, b.a / 255.f);
-  b.g = Math::lerp(a.g, b.g, b.a / 255.f);
-  b.b = Math::lerp(a.b, b.b, b.a / 255.f);
-  return b;
+/**
+ * @brief Copy a rectangle of pixels to another place in the same image
+ *
+ * @param x Source x
+ * @param y Source y
+ * @param width Width, may be negative
+ * @param height Height, may be negative
+ * @param dstX Destination x of the (normalized) source's top left
+ * @param dstY Destination y of the (normalized) source's top left
+ */
+void Image::copyRect(int32_t x, int32_t y, int32_t width, int32_t height,
+                     int32_t dstX, int32_t dstY) {
+  MV_ASSERT(m_Data, "Cannot copyRect: Image data is null!");
+  const VectorMath::Rect<int32_t> rect =
+      normalized(VectorMath::Rect<int32_t>(x, y, width, height));
+  VectorMath::Rect<int32_t> source =
+      rect.intersection(VectorMath::Rect<int32_t>(0, 0, m_Width, m_Height));
+  if (source.width <= 0 || source.height <= 0)
+    return;
+  // Clip the destination and move the source along with it
+  const VectorMath::vec2i offset =
+      VectorMath::vec2i(dstX, dstY) - rect.position();
+  VectorMath::Rect<int32_t> area(source.position() + offset, source.size());
+  if (!clip(area))
+    return;
+  source = VectorMath::Rect<int32_t>(area.position() - offset, area.size());
+
+  // Rows are walked away from the overlap, and memmove handles the overlap
+  // within a row
+  const size_t bytes = area.width * sizeof(uint32_t);
+  if (offset.y > 0) {
+    for (int32_t i = area.height - 1; i >= 0; i--)
+      std::memmove(row(area.y + i) + area.x, row(source.y + i) + source.x,
+                   bytes);
+  } else if (offset.y < 0 || offset.x != 0) {
+    for (int32_t i = 0; i < area.height; i++)
+      std::memmove(row(area.y + i) + area.x, row(source.y + i) + source.x,
+                   bytes);
+  }
+}
+
+/**
+ * @brief Move the content of a rectangle, like a scrolling view. Content
+ * moved out of the rectangle is dropped
+ *
+ * @param rect Area to scroll, clipped
+ * @param dx Horizontal offset
+ * @param dy Vertical offset
+ * @return The strips uncovered by the move, which keep their old pixels and
+ * need redrawing. Zero sized when unused
+ */
+std::array<VectorMath::Rect<int32_t>, 2>
+Image::scroll(VectorMath::Rect<int32_t> rect, int32_t dx, int32_t dy) {
+  MV_ASSERT(m_Data, "Cannot scroll: Image data is null!");
+  std::array<VectorMath::Rect<int32_t>, 2> exposed = {};
+  if (!clip(rect))
+    return exposed;
+  if (Math::abs(dx) >= rect.width || Math::abs(dy) >= rect.height) {
+    exposed[0] = rect;
+    return exposed;
+  }
+  copyRect(rect.x + Math::max(-dx, 0), rect.y + Math::max(-dy, 0),
+           rect.width - Math::abs(dx), rect.height - Math::abs(dy),
+           rect.x + Math::max(dx, 0), rect.y + Math::max(dy, 0));
+
+  // The rows uncovered at the top or bottom, then the columns uncovered at
+  // a side in the rows left
+  if (dy != 0)
+    exposed[0] = VectorMath::Rect<int32_t>(
+        rect.x, dy > 0 ? rect.y : rect.bottom() + dy, rect.width,
+        Math::abs(dy));
+  if (dx != 0)
+    exposed[1] = VectorMath::Rect<int32_t>(
+        dx > 0 ? rect.x : rect.right() + dx, rect.y + Math::max(dy, 0),
+        Math::abs(dx), rect.height - Math::abs(dy));
+  return exposed;
 }
 
 void Image::fillRect(int32_t x, int32_t y, int32_t width, int32_t height,
                      Color color) {
   MV_ASSERT(m_Data, "Cannot fill: Image data is null!");
-  if (x + width <= 0 || y + height <= 0 || x > static_cast<int32_t>(m_Width) ||
-      y > static_cast<int32_t>(m_Height))
-    return;
-  if (width < 0)
-    x += width, width = -width;
-  if (height < 0)
-    y += height, height = -height;
-  if (x < 0)
-    width += x, x = 0;
-  if (y < 0)
-    height += y, y = 0;
-  if (x + width > m_Width)
-    width = m_Width - x;
-  if (y + height > m_Height)
-    height = m_Height - y;
-  if (color.a == 255) {
-    uint32_t c = colorMode(color);
-    for (uint32_t y1 = 0; y1 < height; y1++) {
-      uint32_t *lineStart =
-          reinterpret_cast<uint32_t *>(m_Data) + x + (y + y1) * m_Width;
-      std::fill(lineStart, lineStart + width, c);
-    }
-    return;
-  }
-  for (uint32_t y1 = 0; y1 < height; y1++) {
-    for (uint32_t x1 = 0; x1 < width; x1++) {
-      set(x + x1, y + y1, alphaBlend(get(x + x1, y + y1), color));
+  VectorMath::Rect<int32_t> area(x, y, width, height);
+  if (m_HasTransform) {
+    if (!m_Transform.isAxisAligned()) {
+      static thread_local Path path;
+      path.clear();
+      fillPath(path.rect(normalized(area)), color);
+      return;
     }
+    area = mapBounds(m_Transform, normalized(area));
   }
+  if (!clip(area) || skipsColor(color))
+    return;
+  const uint32_t packed = colorMode(color);
+  const Kernels::Stencil stencil(*this);
+  Kernels::withBlendMode(m_BlendMode, [&](auto mode) {
+    for (int32_t y1 = area.top(); y1 < area.bottom(); y1++)
+      Kernels::fillSpan<decltype(mode)>(row(y1) + area.x, area.width, packed,
+                                        stencil.span(area.x, y1));
+  });
 }
 
 void Image::drawRect(int32_t x, int32_t y, int32_t width, int32_t height,
@@ -319,36 +741,69 @@ void Image::fillRoundRect(int32_t x, int32_t y, int32_t width, int32_t height,
                           Color color, uint8_t rtl, uint8_t rtr, uint8_t rbl,
                           uint8_t rbr) {
   MV_ASSERT(m_Data, "Cannot fill: Image data is null!");
-  if (x + width <= 0 || y + height <= 0 || x > static_cast<int32_t>(m_Width) ||
-      y > static_cast<int32_t>(m_Height))
-    return;
   if (width < 0)
     x += width, width = -width;
   if (height < 0)
     y += height, height = -height;
-  for (uint32_t y1 = Math::max(0, -y);
-       y1 < Math::min(height, static_cast<int32_t>(m_Height) - y); y1++) {
-    for (uint32_t x1 = Math::max(0, -x);
-         x1 < Math::min(width, static_cast<int32_t>(m_Width) - x); x1++) {
-      VectorMath::vec2i roundVector;
-      uint8_t radius = 0;
-      radius += rtl * (x1 <= width / 2 && y1 <= height / 2);
-      radius += rtr * (x1 > width / 2 && y1 <= height / 2);
-      radius += rbl * (x1 <= width / 2 && y1 > height / 2);
-      radius += rbr * (x1 > width / 2 && y1 > height / 2);
-
-      roundVector.x = Math::max(
-          static_cast<int32_t>(radius) - static_cast<int32_t>(x1),
-          static_cast<int32_t>(x1) + static_cast<int32_t>(radius) - width + 1);
-      roundVector.y = Math::max(
-          static_cast<int32_t>(radius) - static_cast<int32_t>(y1),
-          static_cast<int32_t>(y1) + static_cast<int32_t>(radius) - height + 1);
-      Color c = color;
-      c.a *= roundVector.x <= 0 || roundVector.y <= 0 ||
-             roundVector.sqrMagnitude() < radius * radius;
-      set(x + x1, y + y1, alphaBlend(get(x + x1, y + y1), c));
+  if (m_HasTransform) {
+    // Translations and uniform scales keep the corners circular, anything
+    // else goes through the path rasterizer
+    const float scale = m_Transform.m[0][0];
+    if (!m_Transform.isAxisAligned() || scale != m_Transform.m[1][1] ||
+        scale <= 0) {
+      static thread_local Path path;
+      path.clear();
+      fillPath(path.roundRect(VectorMath::Rect<float>(x, y, width, height),
+                              rtl, rtr, rbl, rbr),
+               color);
+      return;
     }
+    const VectorMath::Rect<int32_t> mapped =
+        mapBounds(m_Transform, VectorMath::Rect<float>(x, y, width, height));
+    x = mapped.x, y = mapped.y, width = mapped.width, height = mapped.height;
+    rtl = Math::min(Math::round(rtl * scale), 255);
+    rtr = Math::min(Math::round(rtr * scale), 255);
+    rbl = Math::min(Math::round(rbl * scale), 255);
+    rbr = Math::min(Math::round(rbr * scale), 255);
   }
+  VectorMath::Rect<int32_t> area(x, y, width, height);
+  if (!clip(area) || skipsColor(color))
+    return;
+  auto inside = [&](int32_t x1, int32_t y1) {
+    uint8_t radius = 0;
+    radius += rtl * (x1 <= width / 2 && y1 <= height / 2);
+    radius += rtr * (x1 > width / 2 && y1 <= height / 2);
+    radius += rbl * (x1 <= width / 2 && y1 > height / 2);
+    radius += rbr * (x1 > width / 2 && y1 > height / 2);
+
+    VectorMath::vec2i roundVector;
+    roundVector.x = Math::max(static_cast<int32_t>(radius) - x1,
+                              x1 + static_cast<int32_t>(radius) - width + 1);
+    roundVector.y = Math::max(static_cast<int32_t>(radius) - y1,
+                              y1 + static_cast<int32_t>(radius) - height + 1);
+    return roundVector.x <= 0 || roundVector.y <= 0 ||
+           roundVector.sqrMagnitude() < radius * radius;
+  };
+
+  // Corners only trim the ends of a row, so every row is one span. Its ends
+  // are found by walking in from both sides, at most a radius per side
+  const uint32_t packed = colorMode(color);
+  const Kernels::Stencil stencil(*this);
+  Kernels::withBlendMode(m_BlendMode, [&](auto mode) {
+    for (int32_t y1 = area.top() - y; y1 < area.bottom() - y; y1++) {
+      int32_t from = 0, to = width;
+      while (from < to && !inside(from, y1))
+        from++;
+      while (to > from && !inside(to - 1, y1))
+        to--;
+      from = Math::max(from, area.left() - x);
+      to = Math::min(to, area.right() - x);
+      if (from < to)
+        Kernels::fillSpan<decltype(mode)>(row(y + y1) + x + from, to - from,
+                                          packed,
+                                          stencil.span(x + from, y + y1));
+    }
+  });
 }
 
 void Image::drawLine(int32_t x1, int32_t y1, int32_t x2, int32_t y2,
@@ -359,27 +814,33 @@ void Image::drawLine(int32_t x1, int32_t y1, int32_t x2, int32_t y2,
   else if (y1 == y2)
     fillRect(x1, y1 - thickness / 2, x2 - x1, thickness, color);
   else {
-    int32_t dx = abs(x2 - x1), sx = x1 < x2 ? 1 : -1;
-    int32_t dy = abs(y2 - y1), sy = y1 < y2 ? 1 : -1;
-    int32_t err = (dx > dy ? dx : -dy) / 2, e2;
-
-    for (;;) {
-      setPixel(x1, y1, alphaBlend(getPixel(x1, y1), color));
-      if (x1 == x2 && y1 == y2)
-        break;
-      e2 = err;
-      if (e2 > -dx) {
-        err -= dy;
-        x1 += sx;
-      }
-      if (e2 < dy) {
-        err += dx;
-        y1 += sy;
-      }
-    }
+    StrokeStyle style;
+    style.thickness = thickness;
+    drawLine(VectorMath::vec2f(x1 + 0.5f, y1 + 0.5f),
+             VectorMath::vec2f(x2 + 0.5f, y2 + 0.5f), color, style);
   }
 }
 
+// * drawImage under a rotation or shear: the destination rect becomes a
+// textured quad, sampled nearest
+static void drawImageQuad(Image &target, const Image &image,
+                          VectorMath::Rect<float> rect, bool mirrorX,
+                          bool mirrorY, VectorMath::Rect<float> source) {
+  VectorMath::vec2f corners[4];
+  quadCorners(target.transform(), rect, corners);
+  const int32_t left = source.x, top = source.y;
+  const int32_t right = source.right() - 1, bottom = source.bottom() - 1;
+  const Kernels::PixelConverter convert(image, target);
+  Kernels::rasterizeQuad(
+      target, corners,
+      toSource(target.transform(), rect, mirrorX, mirrorY, source),
+      [&](float u, float v) {
+        const int32_t px = Math::clamp(static_cast<int32_t>(floorf(u)), left, right);
+        const int32_t py = Math::clamp(static_cast<int32_t>(floorf(v)), top, bottom);
+        return convert(image.row(py)[px]);
+      });
+}
+
 void Image::drawImage(const Image &image, int32_t x, int32_t y, int32_t width,
                       int32_t height, uint32_t srcX, uint32_t srcY,
                       uint32_t srcWidth, uint32_t srcHeight) {
@@ -389,28 +850,334 @@ void Image::drawImage(const Image &image, int32_t x, int32_t y, int32_t width,
     width = image.width();
   if (height == 0)
     height = image.height();
-
-  if (x + Math::abs(width) <= 0 || y + Math::abs(height) <= 0 ||
-      x > static_cast<int32_t>(m_Width) || y > static_cast<int32_t>(m_Height))
-    return;
-
   if (srcWidth == 0)
     srcWidth = image.width();
   if (srcHeight == 0)
     srcHeight = image.height();
-  for (uint32_t y1 = Math::max(0, y);
-       y1 < Math::min(y + Math::abs(height), m_Height); y1++) {
-    for (uint32_t x1 = Math::max(0, x);
-         x1 < Math::min(x + Math::abs(width), m_Width); x1++) {
-      uint32_t u = (x1 - x) * srcWidth / Math::abs(width);
+
+  if (m_HasTransform) {
+    const VectorMath::Rect<float> rect(x, y, Math::abs(width),
+                                       Math::abs(height));
+    if (!m_Transform.isAxisAligned()) {
+      drawImageQuad(*this, image, rect, width < 0, height < 0,
+                    VectorMath::Rect<float>(srcX, srcY, srcWidth, srcHeight));
+      return;
+    }
+    // Mirroring scales flip the image like a negative size does
+    const VectorMath::Rect<int32_t> mapped = mapBounds(m_Transform, rect);
+    const bool mirrorX = (width < 0) != (m_Transform.m[0][0] < 0);
+    const bool mirrorY = (height < 0) != (m_Transform.m[1][1] < 0);
+    x = mapped.x, y = mapped.y;
+    width = mirrorX ? -mapped.width : mapped.width;
+    height = mirrorY ? -mapped.height : mapped.height;
+    if (width == 0 || height == 0)
+      return;
+  }
+
+  // A negative size mirrors the image, it still covers [x, x + |width|)
+  VectorMath::Rect<int32_t> area(x, y, Math::abs(width), Math::abs(height));
+  if (!clip(area))
+    return;
+
+  // Source columns are the same for every row, they are computed once
+  static thread_local std::vector<uint32_t> columns, line;
+  columns.resize(area.width), line.resize(area.width);
+  for (int32_t x1 = area.left(); x1 < area.right(); x1++) {
+    uint32_t u = (x1 - x) * srcWidth / Math::abs(width);
+    if (width < 0)
+      u = srcWidth - u - 1;
+    columns[x1 - area.left()] = u + srcX;
+  }
+  // Unscaled, unmirrored rows in the same format blend straight from the source
+  const bool direct = width > 0 && srcWidth == static_cast<uint32_t>(width) &&
+                      image.pixelFormat() == m_Format &&
+                      m_Format != PixelFormat::Custom;
+  const Kernels::PixelConverter convert(image, *this);
+  const Kernels::Stencil stencil(*this);
+  Kernels::withBlendMode(m_BlendMode, [&](auto mode) {
+    using Mode = decltype(mode);
+    for (int32_t y1 = area.top(); y1 < area.bottom(); y1++) {
       uint32_t v = (y1 - y) * srcHeight / Math::abs(height);
-      if (width < 0)
-        u = srcWidth - u - 1;
       if (height < 0)
         v = srcHeight - v - 1;
-      set(x1, y1, alphaBlend(get(x1, y1), image.get(u + srcX, v + srcY)));
+      const uint32_t *source = image.row(v + srcY);
+      if (direct) {
+        Kernels::blendSpan<Mode>(row(y1) + area.x, source + columns[0],
+                                 area.width, stencil.span(area.x, y1));
+        continue;
+      }
+      for (int32_t i = 0; i < area.width; i++)
+        line[i] = convert(source[columns[i]]);
+      Kernels::blendSpan<Mode>(row(y1) + area.x, line.data(), area.width,
+                               stencil.span(area.x, y1));
     }
+  });
+}
+
+// * Maps a transformed mask-sized rect at (x, y) to textured quad corners and
+// the pixel to mask transform
+static VectorMath::mat3f maskQuad(const VectorMath::mat3f &transform,
+                                  int32_t x, int32_t y,
+                                  VectorMath::vec2u size,
+                                  VectorMath::vec2f (&corners)[4]) {
+  const VectorMath::Rect<float> rect(x, y, size.x, size.y);
+  quadCorners(transform, rect, corners);
+  return toSource(transform, rect, false, false,
+                  VectorMath::Rect<float>(0, 0, size.x, size.y));
+}
+
+/**
+ * @brief Blend a color through an A8 mask
+ *
+ * @param mask Coverage, 255 draws the full color
+ * @param x X position of the mask's top left corner
+ * @param y Y position of the mask's top left corner
+ * @param color Color, its alpha scales the coverage
+ */
+void Image::fillMask(const Mask &mask, int32_t x, int32_t y, Color color) {
+  MV_ASSERT(m_Data, "Cannot fillMask: Image data is null!");
+  MV_ASSERT(mask.data(), "Cannot fillMask: Mask data is null!");
+  if (skipsColor(color))
+    return;
+  if (m_HasTransform) {
+    if (!m_Transform.isTranslation()) {
+      // Scaled or rotated masks are textured quads with the mask as alpha
+      VectorMath::vec2f corners[4];
+      const VectorMath::mat3f toMask =
+          maskQuad(m_Transform, x, y, mask.size(), corners);
+      const uint32_t packed = colorMode(color) & 0x00FFFFFF;
+      const int32_t right = mask.width() - 1, bottom = mask.height() - 1;
+      Kernels::rasterizeQuad(*this, corners, toMask, [&](float u, float v) {
+        const int32_t px = Math::clamp(static_cast<int32_t>(floorf(u)), 0, right);
+        const int32_t py = Math::clamp(static_cast<int32_t>(floorf(v)), 0, bottom);
+        return packed | Kernels::mul255(color.a, mask.get(px, py)) << 24;
+      });
+      return;
+    }
+    const VectorMath::vec2i offset =
+        VectorMath::round(m_Transform.translationPart());
+    x += offset.x, y += offset.y;
   }
+
+  VectorMath::Rect<int32_t> area(x, y, mask.width(), mask.height());
+  if (!clip(area))
+    return;
+  const uint32_t packed = colorMode(color);
+  const Kernels::Stencil stencil(*this);
+  Kernels::withBlendMode(m_BlendMode, [&](auto mode) {
+    for (int32_t y1 = area.top(); y1 < area.bottom(); y1++)
+      Kernels::fillSpanMask<decltype(mode)>(
+          row(y1) + area.x, mask.row(y1 - y) + area.x - x, area.width, packed,
+          stencil.span(area.x, y1));
+  });
+}
+
+/**
+ * @brief Draw an image with an A8 mask scaling its alpha
+ *
+ * @param image The image
+ * @param mask Coverage of every image pixel, the same size as the image
+ * @param x X position
+ * @param y Y position
+ */
+void Image::drawImage(const Image &image, const Mask &mask, int32_t x,
+                      int32_t y) {
+  MV_ASSERT(m_Data, "Cannot drawImage: Image data is null!");
+  MV_ASSERT(image.data(), "Cannot drawImage: Other image data is null!");
+  MV_ASSERT(mask.size() == image.size(),
+            "Mask size %ux%u doesn't match the image size %ux%u!",
+            mask.width(), mask.height(), image.width(), image.height());
+  const Kernels::PixelConverter convert(image, *this);
+  if (m_HasTransform) {
+    if (!m_Transform.isTranslation()) {
+      VectorMath::vec2f corners[4];
+      const VectorMath::mat3f toMask =
+          maskQuad(m_Transform, x, y, mask.size(), corners);
+      const int32_t right = mask.width() - 1, bottom = mask.height() - 1;
+      Kernels::rasterizeQuad(*this, corners, toMask, [&](float u, float v) {
+        const int32_t px = Math::clamp(static_cast<int32_t>(floorf(u)), 0, right);
+        const int32_t py = Math::clamp(static_cast<int32_t>(floorf(v)), 0, bottom);
+        const uint32_t color = convert(image.row(py)[px]);
+        return (color & 0x00FFFFFF) | Kernels::mul255(color >> 24, mask.get(px, py)) << 24;
+      });
+      return;
+    }
+    const VectorMath::vec2i offset =
+        VectorMath::round(m_Transform.translationPart());
+    x += offset.x, y += offset.y;
+  }
+
+  VectorMath::Rect<int32_t> area(x, y, image.width(), image.height());
+  if (!clip(area))
+    return;
+  const bool direct =
+      image.pixelFormat() == m_Format && m_Format != PixelFormat::Custom;
+  static thread_local std::vector<uint32_t> line;
+  line.resize(area.width);
+  const Kernels::Stencil stencil(*this);
+  Kernels::withBlendMode(m_BlendMode, [&](auto mode) {
+    for (int32_t y1 = area.top(); y1 < area.bottom(); y1++) {
+      const uint32_t *source = image.row(y1 - y) + area.x - x;
+      if (!direct) {
+        for (int32_t i = 0; i < area.width; i++)
+          line[i] = convert(source[i]);
+        source = line.data();
+      }
+      Kernels::blendSpanMask<decltype(mode)>(
+          row(y1) + area.x, source, mask.row(y1 - y) + area.x - x, area.width,
+          stencil.span(area.x, y1));
+    }
+  });
+}
+
+// * One axis of a nine-slice: dest [to, to + toLength) shows source
+// [from, from + fromLength), stretched or repeated
+struct SliceSpan {
+  int32_t to, toLength, from, fromLength;
+  bool tile;
+
+  int32_t source(int32_t d) const {
+    const int32_t offset = d - to;
+    if (tile)
+      return from + offset % fromLength;
+    return from + static_cast<int32_t>(static_cast<int64_t>(offset) *
+                                       fromLength / toLength);
+  }
+  // Runs of dest pixels read consecutive source pixels
+  bool contiguous() const { return tile || toLength == fromLength; }
+  bool empty() const { return toLength <= 0 || fromLength <= 0; }
+};
+
+// * Borders keep their size, unless the dest is too small for both. Then
+// they share it in proportion and the middle vanishes
+static void sliceAxis(int32_t to, int32_t toLength, int32_t sourceLength,
+                      int32_t low, int32_t high, bool tile,
+                      SliceSpan (&spans)[3]) {
+  low = Math::clamp(low, 0, sourceLength);
+  high = Math::clamp(high, 0, sourceLength - low);
+  int32_t toLow = low, toHigh = high;
+  if (low + high > toLength) {
+    toLow = toLength * low / (low + high);
+    toHigh = toLength - toLow;
+  }
+  spans[0] = SliceSpan{to, toLow, 0, low, false};
+  spans[1] = SliceSpan{to + toLow, toLength - toLow - toHigh, low,
+                       sourceLength - low - high, tile};
+  spans[2] = SliceSpan{to + toLength - toHigh, toHigh, sourceLength - high,
+                       high, false};
+}
+
+/**
+ * @brief Draw a stretchable bordered image. Corners are drawn unscaled, edges
+ * and center stretch or repeat to fill the rest of the rect. All arguments
+ * are plain values, so a call can be recorded and replayed as is
+ *
+ * @param image The image
+ * @param insets Widths of the image's borders
+ * @param rect Destination rect
+ * @param fill Whether edges and center stretch or tile
+ */
+void Image::drawNineSlice(const Image &image, Insets insets,
+                          VectorMath::Rect<int32_t> rect, SliceFill fill) {
+  MV_ASSERT(m_Data, "Cannot drawNineSlice: Image data is null!");
+  MV_ASSERT(image.data(), "Cannot drawNineSlice: Other image data is null!");
+  rect = normalized(rect);
+  if (rect.width == 0 || rect.height == 0)
+    return;
+  const bool tile = fill == SliceFill::Tile;
+  SliceSpan columns[3], rows[3];
+
+  if (m_HasTransform && !m_Transform.isTranslation()) {
+    // Scaled or rotated slices (and every tile) are mapped by drawImage
+    sliceAxis(rect.x, rect.width, image.width(), insets.left, insets.right,
+              tile, columns);
+    sliceAxis(rect.y, rect.height, image.height(), insets.top,
+              insets.bottom, tile, rows);
+    for (const SliceSpan &rowSpan : rows) {
+      for (const SliceSpan &span : columns) {
+        if (rowSpan.empty() || span.empty())
+          continue;
+        const int32_t stepX = span.tile ? span.fromLength : span.toLength;
+        const int32_t stepY = rowSpan.tile ? rowSpan.fromLength : rowSpan.toLength;
+        for (int32_t y = 0; y < rowSpan.toLength; y += stepY) {
+          for (int32_t x = 0; x < span.toLength; x += stepX) {
+            const int32_t width = Math::min(stepX, span.toLength - x);
+            const int32_t height = Math::min(stepY, rowSpan.toLength - y);
+            drawImage(image, span.to + x, rowSpan.to + y, width, height,
+                      span.from, rowSpan.from,
+                      span.tile ? width : span.fromLength,
+                      rowSpan.tile ? height : rowSpan.fromLength);
+          }
+        }
+      }
+    }
+    return;
+  }
+  if (m_HasTransform) {
+    const VectorMath::vec2i offset =
+        VectorMath::round(m_Transform.translationPart());
+    rect.x += offset.x, rect.y += offset.y;
+  }
+  sliceAxis(rect.x, rect.width, image.width(), insets.left, insets.right,
+            tile, columns);
+  sliceAxis(rect.y, rect.height, image.height(), insets.top, insets.bottom,
+            tile, rows);
+  VectorMath::Rect<int32_t> area = rect;
+  if (!clip(area))
+    return;
+
+  // Source columns are the same for every row, they are picked once
+  static thread_local std::vector<uint32_t> sourceColumns, line;
+  sourceColumns.resize(area.width), line.resize(area.width);
+  for (const SliceSpan &span : columns) {
+    if (span.empty())
+      continue;
+    const int32_t x0 = Math::max(span.to, area.left());
+    const int32_t x1 = Math::min(span.to + span.toLength, area.right());
+    for (int32_t x = x0; x < x1; x++)
+      sourceColumns[x - area.x] = span.source(x);
+  }
+
+  // Corners and tiles blend straight from the source in runs, stretched
+  // slices (and other formats) are gathered first
+  const bool direct =
+      image.pixelFormat() == m_Format && m_Format != PixelFormat::Custom;
+  const Kernels::PixelConverter convert(image, *this);
+  const Kernels::Stencil stencil(*this);
+  Kernels::withBlendMode(m_BlendMode, [&](auto mode) {
+    using Mode = decltype(mode);
+    for (const SliceSpan &rowSpan : rows) {
+      if (rowSpan.empty())
+        continue;
+      const int32_t y0 = Math::max(rowSpan.to, area.top());
+      const int32_t y1 = Math::min(rowSpan.to + rowSpan.toLength, area.bottom());
+      for (int32_t y = y0; y < y1; y++) {
+        const uint32_t *source = image.row(rowSpan.source(y));
+        uint32_t *target = row(y);
+        for (const SliceSpan &span : columns) {
+          const int32_t x0 = Math::max(span.to, area.left());
+          const int32_t x1 = Math::min(span.to + span.toLength, area.right());
+          if (span.empty() || x0 >= x1)
+            continue;
+          if (direct && span.contiguous()) {
+            for (int32_t x = x0; x < x1;) {
+              const int32_t from = sourceColumns[x - area.x];
+              const int32_t run =
+                  Math::min(x1 - x, span.from + span.fromLength - from);
+              Kernels::blendSpan<Mode>(target + x, source + from, run,
+                                       stencil.span(x, y));
+              x += run;
+            }
+            continue;
+          }
+          for (int32_t x = x0; x < x1; x++)
+            line[x - x0] = convert(source[sourceColumns[x - area.x]]);
+          Kernels::blendSpan<Mode>(target + x0, line.data(), x1 - x0,
+                                   stencil.span(x0, y));
+        }
+      }
+    }
+  });
 }
 
 static std::wstring utf8_to_ws(const std::string &utf8) {
@@ -420,6 +1187,67 @@ static std::wstring utf8_to_ws(const std::string &utf8) {
   return s;
 }
 
+// * Blend one glyph quad of the font atlas, clipped once up front
+static void drawGlyph(Image &image, const Font &font, stbtt_aligned_quad quad,
+                      Color color) {
+  if (quad.x1 <= quad.x0 || quad.y1 <= quad.y0)
+    return;
+  if (image.hasTransform()) {
+    const VectorMath::mat3f &transform = image.transform();
+    if (!transform.isAxisAligned()) {
+      // Rotated or sheared glyphs are textured quads with the atlas as alpha
+      const VectorMath::Rect<float> rect(quad.x0, quad.y0, quad.x1 - quad.x0,
+                                         quad.y1 - quad.y0);
+      const VectorMath::Rect<float> source(quad.s0, quad.t0, quad.s1 - quad.s0,
+                                           quad.t1 - quad.t0);
+      VectorMath::vec2f corners[4];
+      quadCorners(transform, rect, corners);
+      const uint32_t packed = image.pack(color) & 0x00FFFFFF;
+      const int32_t left = source.x, top = source.y;
+      const int32_t right = source.right() - 1, bottom = source.bottom() - 1;
+      Kernels::rasterizeQuad(
+          image, corners, toSource(transform, rect, false, false, source),
+          [&](float u, float v) {
+            const int32_t px = Math::clamp(static_cast<int32_t>(floorf(u)), left, right);
+            const int32_t py = Math::clamp(static_cast<int32_t>(floorf(v)), top, bottom);
+            return packed | Kernels::mul255(color.a, font.atlas.get(px, py)) << 24;
+          });
+      return;
+    }
+    const VectorMath::vec2f from = transform * VectorMath::vec2f(quad.x0, quad.y0);
+    const VectorMath::vec2f to = transform * VectorMath::vec2f(quad.x1, quad.y1);
+    quad.x0 = from.x, quad.y0 = from.y, quad.x1 = to.x, quad.y1 = to.y;
+  }
+
+  // Mirroring transforms swap the quad's corners, the atlas is then read
+  // backwards
+  VectorMath::Rect<int32_t> area(Math::min(quad.x0, quad.x1),
+                                 Math::min(quad.y0, quad.y1),
+                                 Math::abs(quad.x1 - quad.x0),
+                                 Math::abs(quad.y1 - quad.y0));
+  if (!image.clip(area))
+    return;
+  const float du = (quad.s1 - quad.s0) / (quad.x1 - quad.x0);
+  const float dv = (quad.t1 - quad.t0) / (quad.y1 - quad.y0);
+  static thread_local std::vector<uint8_t> coverage;
+  coverage.resize(area.width);
+  const uint32_t packed = image.pack(color);
+  const Kernels::Stencil stencil(image);
+  Kernels::withBlendMode(image.blendMode(), [&](auto mode) {
+    for (int32_t y1 = area.top(); y1 < area.bottom(); y1++) {
+      const uint32_t v = Math::clamp((y1 - quad.y0) * dv + quad.t0, quad.t0, quad.t1 - 1);
+      const uint8_t *atlasRow = font.atlas.row(v);
+      for (int32_t x1 = area.left(); x1 < area.right(); x1++) {
+        const uint32_t u = Math::clamp((x1 - quad.x0) * du + quad.s0, quad.s0, quad.s1 - 1);
+        coverage[x1 - area.left()] = atlasRow[u];
+      }
+      Kernels::fillSpanMask<decltype(mode)>(image.row(y1) + area.x,
+                                            coverage.data(), area.width, packed,
+                                            stencil.span(area.x, y1));
+    }
+  });
+}
+
 VectorMath::vec2u Image::drawText(int32_t x, int32_t y, std::string_view text,
                                   Color color) {
   MV_ASSERT(font, "No font is set!");
@@ -436,19 +1264,7 @@ VectorMath::vec2u Image::drawText(int32_t x, int32_t y, std::string_view text,
     if (ch == '\n')
       size.y += font->height(), characterY += font->height();
 
-    for (uint32_t y1 = quad.y0; y1 < quad.y1; y1++) {
-      for (uint32_t x1 = quad.x0; x1 < quad.x1; x1++) {
-        uint32_t u =
-            (x1 - quad.x0) * (quad.s1 - quad.s0) / (quad.x1 - quad.x0) +
-            quad.s0;
-        uint32_t v =
-            (y1 - quad.y0) * (quad.t1 - quad.t0) / (quad.y1 - quad.y0) +
-            quad.t0;
-        Color c = color;
-        c.a = c.a * font->atlas[u + v * font->atlasSize.x] / 255;
-        setPixel(x1, y1, alphaBlend(getPixel(x1, y1), c));
-      }
-    }
+    drawGlyph(*this, *font, quad, color);
     characterX = static_cast<int>(characterX);
   }
   size.x = Math::max(size.x, characterX - x);
@@ -466,17 +1282,7 @@ VectorMath::vec2u Image::drawChar(int32_t x, int32_t y, wchar_t character,
   font->getQuadFromCodepoint(character, characterX, characterY, quad);
   size.x = characterX - x;
   size.y = Math::max(size.y, quad.y1 - quad.y0);
-  for (uint32_t y1 = quad.y0; y1 < quad.y1; y1++) {
-    for (uint32_t x1 = quad.x0; x1 < quad.x1; x1++) {
-      uint32_t u =
-          (x1 - quad.x0) * (quad.s1 - quad.s0) / (quad.x1 - quad.x0) + quad.s0;
-      uint32_t v =
-          (y1 - quad.y0) * (quad.t1 - quad.t0) / (quad.y1 - quad.y0) + quad.t0;
-      Color c = color;
-      c.a = c.a * font->atlas[u + v * font->atlasSize.x] / 255;
-      setPixel(x1, y1, alphaBlend(getPixel(x1, y1), c));
-    }
-  }
+  drawGlyph(*this, *font, quad, color);
   return size;
 }
 
@@ -500,4 +1306,75 @@ VectorMath::vec2u Image::getTextSize(std::string_view text) {
   return size;
 }
 #pragma endregion Draw
+#pragma region Layer
+void Layer::setSize(uint32_t width, uint32_t height) {
+  if (m_Image.width() == width && m_Image.height() == height)
+    return;
+  m_Image.setSize(width, height);
+  m_Valid = false;
+}
+
+/**
+ * @brief Composite a layer in one pass, with its opacity and blend mode. Layer
+ * content is premultiplied, as drawing onto its cleared image leaves it
+ *
+ * @param layer The layer, placed at its position
+ */
+void Image::drawLayer(const Layer &layer) {
+  MV_ASSERT(m_Data, "Cannot drawLayer: Image data is null!");
+  const Image &source = layer.m_Image;
+  if (!layer.m_Visible || !source.data() || layer.m_Opacity == 0)
+    return;
+  VectorMath::vec2i position = layer.m_Position;
+  if (m_HasTransform) {
+    if (!m_Transform.isTranslation()) {
+      // Rotated or scaled layers go through the textured quad rasterizer
+      const VectorMath::Rect<float> rect(position, source.size());
+      VectorMath::vec2f corners[4];
+      quadCorners(m_Transform, rect, corners);
+      const Kernels::PixelConverter convert(source, *this);
+      const int32_t right = source.width() - 1, bottom = source.height() - 1;
+      auto sample = [&](float u, float v) {
+        const int32_t px = Math::clamp(static_cast<int32_t>(floorf(u)), 0, right);
+        const int32_t py = Math::clamp(static_cast<int32_t>(floorf(v)), 0, bottom);
+        const uint32_t color = Kernels::unpremultiply(convert(source.row(py)[px]));
+        return (color & 0x00FFFFFF) | Kernels::mul255(color >> 24, layer.m_Opacity) << 24;
+      };
+      const VectorMath::mat3f toLayer = toSource(
+          m_Transform, rect, false, false,
+          VectorMath::Rect<float>(0, 0, source.width(), source.height()));
+      Kernels::withBlendMode(layer.m_BlendMode, [&](auto mode) {
+        Kernels::rasterizeQuadIn<decltype(mode)>(*this, corners, toLayer,
+                                                 sample);
+      });
+      return;
+    }
+    position += VectorMath::round(m_Transform.translationPart());
+  }
+
+  VectorMath::Rect<int32_t> area(position, source.size());
+  if (!clip(area))
+    return;
+  const bool convertRows = source.pixelFormat() != m_Format ||
+                           m_Format == PixelFormat::Custom;
+  const Kernels::PixelConverter convert(source, *this);
+  static thread_local std::vector<uint32_t> line;
+  line.resize(area.width);
+  const Kernels::Stencil stencil(*this);
+  Kernels::withBlendMode(layer.m_BlendMode, [&](auto mode) {
+    for (int32_t y = area.top(); y < area.bottom(); y++) {
+      const uint32_t *from =
+          source.row(y - position.y) + (area.x - position.x);
+      if (convertRows) {
+        for (int32_t i = 0; i < area.width; i++)
+          line[i] = convert(from[i]);
+        from = line.data();
+      }
+      Kernels::compositeSpan<decltype(mode)>(row(y) + area.x, from,
+                                             area.width, layer.m_Opacity,
+                                             stencil.span(area.x, y));
+    }
+  });
+}
+#pragma endregion Layer
 } // namespace Mova
@@ -2,8 +2,12 @@
 #include <functional>
 #include <lib/OreonMath.hpp>
 #include <lib/logassert.h>
+#include <lib/stb_rect_pack.h> // Before stb_truetype, so font packing uses it too
 #include <lib/stb_truetype.h>
+#include <array>
+#include <cmath>
 #include <map>
+#include <movaAllocator.hpp>
 #include <memory>
 #include <string_view>
 #include <sys/types.h>
@@ -23,12 +27,320 @@ struct Color {
   };
 
   static Color hsv(uint16_t hue, uint8_t saturation, uint8_t value, uint8_t alpha = 255);
+  static void hsv(const uint16_t* hue, const uint8_t* saturation, const uint8_t* value, Color* out, size_t count, uint8_t alpha = 255); // Arrays of count values, like palettes
 
   static const Color white, black, transperent;
   static const Color red, green, blue;
   static const Color yellow, cyan, magenta;
 };
 
+using ColorMode = std::function<uint32_t(Color color)>;
+using ReverseColorMode = std::function<Color(uint32_t color)>;
+uint32_t colorModeRGB(Color color);
+uint32_t colorModeBGR(Color color);
+Color reverseColorModeRGB(uint32_t color);
+Color reverseColorModeBGR(uint32_t color);
+
+enum class PixelFormat { RGBA, BGRA, Custom };
+
+enum class LineCap { Butt, Square, Round };
+enum class LineJoin { Miter, Bevel, Round };
+struct StrokeStyle {
+  float thickness = 3;
+  LineCap cap = LineCap::Round;
+  LineJoin join = LineJoin::Round;
+  float miterLimit = 4; // Longest miter, in thicknesses, before it falls back to a bevel
+};
+
+enum class FillRule { NonZero, EvenOdd };
+
+// 4x5 matrix over straight RGBA in 0 to 1: every output channel is a weighted sum of r, g, b, a plus the last column.
+// Results are clamped, so chains of adjustments should be multiplied together and applied once
+struct ColorMatrix {
+  std::array<float, 20> m = {1, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 1, 0}; // Row major, rows are r, g, b, a
+
+  float& operator()(uint32_t row, uint32_t column) { return m[row * 5 + column]; }
+  float operator()(uint32_t row, uint32_t column) const { return m[row * 5 + column]; }
+  ColorMatrix operator*(const ColorMatrix& other) const; // Applies other first, then this
+
+  static ColorMatrix brightness(float amount); // Adds amount to r, g and b, -1 to 1
+  static ColorMatrix contrast(float amount);   // Scales around middle gray, 1 keeps the image
+  static ColorMatrix saturation(float amount); // 0 is grayscale, 1 keeps the image, above 1 boosts colors
+  static ColorMatrix hueRotation(float angle); // Radians, keeps luminance
+  static ColorMatrix tint(Color color, float amount = 1); // Multiplies the channels by color, faded in by amount
+  static ColorMatrix grayscale(float amount = 1) { return saturation(1 - amount); }
+};
+
+// How drawn pixels combine with the image. Color modes mix each channel and fade the result in by the source alpha
+enum class BlendMode {
+  Over,     // Source over destination
+  Copy,     // Replace the destination, alpha included
+  Add,      // Saturating sum, for glows and light
+  Multiply, // Darkens
+  Screen,   // Lightens
+  Min,
+  Max,
+  Xor, // Flip the destination's color bits where the source is at least half opaque, drawing twice restores it
+};
+
+// What drawing does with the image's stencil, an 8-bit mask over its pixels
+enum class StencilMode {
+  Off,     // Draw normally
+  Write,   // Draw into the stencil only, raising it to the drawn alpha. Pixels are left unchanged
+  Inside,  // Draw scaled by the stencil, so anti-aliased stencil edges stay smooth
+  Outside, // Draw scaled by the inverted stencil
+};
+
+struct GradientStop {
+  float offset; // 0 to 1
+  Color color;
+};
+
+enum class GradientSpread { Pad, Repeat, Reflect };
+
+// Linear or radial multi-stop gradient paint. Stops are baked into a 256-entry color table on construction
+class Gradient {
+public:
+  enum class Type { Linear, Radial };
+
+  static Gradient linear(VectorMath::vec2f start, VectorMath::vec2f end, const std::vector<GradientStop>& stops) { return Gradient(Type::Linear, start, end, 0, stops); }
+  static Gradient linear(VectorMath::vec2f start, VectorMath::vec2f end, Color from, Color to) { return linear(start, end, {{0, from}, {1, to}}); }
+  static Gradient radial(VectorMath::vec2f center, float radius, const std::vector<GradientStop>& stops) { return Gradient(Type::Radial, center, center, radius, stops); }
+  static Gradient radial(VectorMath::vec2f center, float radius, Color inner, Color outer) { return radial(center, radius, {{0, inner}, {1, outer}}); }
+
+  Gradient& setSpread(GradientSpread spread) { m_Spread = spread; return *this; }
+  Gradient& setDither(bool dither) { m_Dither = dither; return *this; } // 4x4 ordered dither, hides banding in long, low-contrast gradients
+
+  Type type() const { return m_Type; }
+  VectorMath::vec2f start() const { return m_Start; }
+  VectorMath::vec2f end() const { return m_End; }
+  float radius() const { return m_Radius; }
+  GradientSpread spread() const { return m_Spread; }
+  bool dither() const { return m_Dither; }
+  const std::array<Color, 256>& table() const { return m_Table; }
+  const std::array<uint16_t, 256 * 4>& wideTable() const { return m_WideTable; }
+
+protected:
+  Gradient(Type type, VectorMath::vec2f start, VectorMath::vec2f end, float radius, std::vector<GradientStop> stops);
+
+  Type m_Type;
+  VectorMath::vec2f m_Start, m_End;
+  float m_Radius;
+  GradientSpread m_Spread = GradientSpread::Pad;
+  bool m_Dither = false;
+  std::array<Color, 256> m_Table;
+  std::array<uint16_t, 256 * 4> m_WideTable; // RGBA in 8.8 fixed point, for dithering
+};
+
+// Vector outline, curves are flattened to line segments as they are added
+class Path {
+public:
+  struct Contour {
+    uint32_t start, count;
+    bool closed;
+  };
+
+  Path& moveTo(VectorMath::vec2f point);
+  Path& lineTo(VectorMath::vec2f point);
+  Path& quadTo(VectorMath::vec2f control, VectorMath::vec2f point);
+  Path& cubicTo(VectorMath::vec2f control1, VectorMath::vec2f control2, VectorMath::vec2f point);
+  Path& close();
+  void clear();
+
+  Path& rect(VectorMath::Rect<float> rect);
+  Path& arc(VectorMath::vec2f center, float radius, float startAngle, float endAngle); // Connects to the current contour
+  Path& roundRect(VectorMath::Rect<float> rect, float rtl, float rtr, float rbl, float rbr);
+  Path& transform(const VectorMath::mat3f& transform); // Maps every point
+  Path& polygon(const VectorMath::vec2f* points, size_t count);
+  Path& polygon(const std::vector<VectorMath::vec2f>& points) { return polygon(points.data(), points.size()); }
+
+  const std::vector<VectorMath::vec2f>& points() const { return m_Points; }
+  const std::vector<Contour>& contours() const { return m_Contours; }
+
+protected:
+  std::vector<VectorMath::vec2f> m_Points;
+  std::vector<Contour> m_Contours;
+};
+
+// Separable blur kernels
+enum class BlurFilter {
+  Box,     // One box pass, radius is the box's half width
+  Gaussian // Three box passes approximating a Gaussian with a standard deviation of radius / 2
+};
+
+// Resampling filters, from fastest to sharpest. Downscaling widens them to cover every source pixel
+enum class ResampleFilter {
+  Box,      // Area average, best for thumbnails
+  Bilinear, // Triangle
+  Bicubic,  // Catmull-Rom
+  Lanczos,  // Three lobes
+};
+
+// 8-bit coverage image (A8) at a quarter of the memory of an Image: glyph atlases, pre-rasterized shapes and shadows.
+// Drawn in a color with Image::fillMask, or used as the alpha of an image with drawImage
+class Mask {
+public:
+  Mask() = default;
+  Mask(const Mask& other) { *this = other; }
+  Mask(Mask&& other) noexcept { swap(other); }
+  Mask(uint32_t width, uint32_t height, const uint8_t* data = nullptr);
+  Mask(VectorMath::vec2u size, const uint8_t* data = nullptr) : Mask(size.x, size.y, data) {}
+  ~Mask() {
+    if (m_Data) m_Allocator->deallocate(m_Data, m_Capacity);
+  }
+
+  Mask& operator=(const Mask& other);
+  Mask& operator=(Mask&& other) noexcept {
+    swap(other);
+    return *this;
+  }
+  void swap(Mask& other) noexcept;
+
+  // Getters. Rows are tightly packed, one byte per pixel
+  uint8_t* data() { return m_Data; }
+  const uint8_t* data() const { return m_Data; }
+  uint32_t width() const { return m_Width; }
+  uint32_t height() const { return m_Height; }
+  VectorMath::vec2u size() const { return VectorMath::vec2u(m_Width, m_Height); }
+  uint8_t* row(uint32_t y) { return m_Data + static_cast<size_t>(y) * m_Width; }
+  const uint8_t* row(uint32_t y) const { return m_Data + static_cast<size_t>(y) * m_Width; }
+
+  void setSize(uint32_t width, uint32_t height); // Content is cleared
+  void setSize(VectorMath::vec2u size) { setSize(size.x, size.y); }
+  void clear(uint8_t value = 0);
+  inline void set(uint32_t x, uint32_t y, uint8_t value) { row(y)[x] = value; }
+  inline uint8_t get(uint32_t x, uint32_t y) const { return row(y)[x]; }
+
+  // Shapes add their anti-aliased coverage, overlaps keep the maximum. Coordinates are mask pixels
+  void fillPath(const Path& path, FillRule rule = FillRule::NonZero);
+  void strokePath(const Path& path, const StrokeStyle& style = StrokeStyle());
+  void blur(float radius, BlurFilter filter = BlurFilter::Gaussian); // In place, edges extend outwards
+
+protected:
+  uint8_t* m_Data = nullptr;
+  uint32_t m_Width = 0, m_Height = 0;
+  size_t m_Capacity = 0;
+  ImageAllocator* m_Allocator = &getDefaultAllocator();
+};
+
+// Border widths of a nine-slice image: the corners keep their size, edges and center fill the rest
+struct Insets {
+  constexpr Insets() = default;
+  constexpr Insets(int32_t all) : left(all), top(all), right(all), bottom(all) {}
+  constexpr Insets(int32_t left, int32_t top, int32_t right, int32_t bottom) : left(left), top(top), right(right), bottom(bottom) {}
+
+  int32_t left = 0, top = 0, right = 0, bottom = 0;
+};
+
+// How nine-slice edges and center fill their space
+enum class SliceFill { Stretch, Tile };
+
+// Pixel storage of a CompactImage
+enum class CompactFormat {
+  RGB565,  // 16 bits, opaque
+  Indexed8 // 8-bit index into a palette of up to 256 colors, which may be translucent
+};
+
+class Image;
+
+// One float per pixel for 3D drawing. Smaller depths are closer, a cleared buffer is infinitely far
+class DepthBuffer {
+public:
+  DepthBuffer() = default;
+  DepthBuffer(uint32_t width, uint32_t height) { setSize(width, height); }
+  DepthBuffer(VectorMath::vec2u size) : DepthBuffer(size.x, size.y) {}
+
+  void setSize(uint32_t width, uint32_t height); // Content is cleared
+  void setSize(VectorMath::vec2u size) { setSize(size.x, size.y); }
+  void clear(float depth = INFINITY);
+
+  float* data() { return m_Data.data(); }
+  const float* data() const { return m_Data.data(); }
+  float* row(uint32_t y) { return m_Data.data() + static_cast<size_t>(y) * m_Width; }
+  const float* row(uint32_t y) const { return m_Data.data() + static_cast<size_t>(y) * m_Width; }
+  uint32_t width() const { return m_Width; }
+  uint32_t height() const { return m_Height; }
+  VectorMath::vec2u size() const { return VectorMath::vec2u(m_Width, m_Height); }
+
+protected:
+  std::vector<float> m_Data;
+  uint32_t m_Width = 0, m_Height = 0;
+};
+
+// Triangle corner. position is in image coordinates (x, y) and depth (z). w is what perspective divided the position by,
+// 1 without perspective. It makes uv and color interpolation perspective correct and must be positive
+struct Vertex {
+  VectorMath::vec3f position;
+  float w = 1;
+  VectorMath::vec2f uv; // 0 to 1 across the texture, repeating outside
+  Color color = Color::white;
+};
+
+enum class Shading {
+  Flat,   // The first vertex's color for the whole triangle
+  Gouraud // Colors interpolated between the vertices
+};
+
+struct TriangleStyle {
+  const Image* texture = nullptr; // Sampled at uv and multiplied by the color when set
+  DepthBuffer* depth = nullptr;   // Tested and written when set, with the image's size
+  Shading shading = Shading::Gouraud;
+  bool cullBackFaces = false; // Front faces are counter-clockwise on the image (y down)
+};
+
+// Image stored at 16 or 8 bits per pixel, for targets short on memory and bandwidth. Drawing happens on a 32-bit Image:
+// compact images are converted from one with convert and blitted back with Image::drawImage
+class CompactImage {
+public:
+  CompactImage() = default;
+  CompactImage(const CompactImage& other) { *this = other; }
+  CompactImage(CompactImage&& other) noexcept { swap(other); }
+  CompactImage(uint32_t width, uint32_t height, CompactFormat format = CompactFormat::RGB565, std::vector<Color> palette = {});
+  CompactImage(VectorMath::vec2u size, CompactFormat format = CompactFormat::RGB565, std::vector<Color> palette = {}) : CompactImage(size.x, size.y, format, std::move(palette)) {}
+  ~CompactImage() {
+    if (m_Data) m_Allocator->deallocate(m_Data, m_Capacity);
+  }
+
+  CompactImage& operator=(const CompactImage& other);
+  CompactImage& operator=(CompactImage&& other) noexcept {
+    swap(other);
+    return *this;
+  }
+  void swap(CompactImage& other) noexcept;
+
+  // Getters
+  uint8_t* data() { return m_Data; }
+  const uint8_t* data() const { return m_Data; }
+  uint32_t width() const { return m_Width; }
+  uint32_t height() const { return m_Height; }
+  VectorMath::vec2u size() const { return VectorMath::vec2u(m_Width, m_Height); }
+  CompactFormat format() const { return m_Format; }
+  uint32_t bytesPerPixel() const { return m_Format == CompactFormat::RGB565 ? 2 : 1; }
+  uint32_t stride() const { return m_Width * bytesPerPixel(); }
+  uint8_t* row(uint32_t y) { return m_Data + static_cast<size_t>(y) * stride(); }
+  const uint8_t* row(uint32_t y) const { return m_Data + static_cast<size_t>(y) * stride(); }
+
+  void setSize(uint32_t width, uint32_t height); // Content is cleared
+  void setSize(VectorMath::vec2u size) { setSize(size.x, size.y); }
+  void setPalette(std::vector<Color> palette);
+  const std::vector<Color>& palette() const { return m_Palette; }
+  Color get(uint32_t x, uint32_t y) const;
+
+  // Resizes to the image and stores its pixels. Indexed images pick the nearest palette color,
+  // mostly transparent pixels take the first fully transparent palette entry when there is one
+  void convert(const Image& image);
+
+protected:
+  uint8_t* m_Data = nullptr;
+  uint32_t m_Width = 0, m_Height = 0;
+  size_t m_Capacity = 0;
+  CompactFormat m_Format = CompactFormat::RGB565;
+  ImageAllocator* m_Allocator = &getDefaultAllocator();
+  std::vector<Color> m_Palette;
+  std::vector<uint8_t> m_Nearest; // Palette index of every RGB555 color, built on the first convert
+  int32_t m_Transparent = -1;     // First fully transparent palette entry
+};
+
 struct Font {
   struct Range {
     wchar_t first, last;
@@ -50,8 +362,7 @@ struct Font {
     return advance;
   }
 
-  uint8_t* atlas = nullptr;
-  VectorMath::vec2u atlasSize;
+  Mask atlas; // Coverage of every packed glyph
 
   uint32_t ascent() { return m_Ascent; }
   uint32_t height() { return m_Height; }
@@ -61,42 +372,90 @@ protected:
   std::vector<stbtt_pack_range> m_Ranges;
 };
 
-using ColorMode = std::function<uint32_t(Color color)>;
-using ReverseColorMode = std::function<Color(uint32_t color)>;
-uint32_t colorModeRGB(Color color);
-uint32_t colorModeBGR(Color color);
-Color reverseColorModeRGB(uint32_t color);
-Color reverseColorModeBGR(uint32_t color);
+class Layer;
 
 class Image {
 public:
   // Constructors
   Image() = default;
-  Image(const Image& other) : Image(other.size(), other.data()) {}
-  Image(Image&& other) noexcept : Image(other.size(), other.data()) {}
+  Image(const Image& other) { *this = other; }
+  Image(Image&& other) noexcept { swap(other); }
   Image(uint32_t width, uint32_t height, const uint8_t* data = nullptr);
   Image(VectorMath::vec2u size, const uint8_t* data = nullptr) : Image(size.x, size.y, data) {}
   Image(std::string_view path);
   ~Image() {
-    if (m_Data) delete[] m_Data;
+    if (m_Data && !m_External) m_Allocator->deallocate(m_Data, m_Capacity);
   }
 
+  // Image over foreign memory: drawing goes straight into data, which is never freed, reallocated or resized by the image.
+  // The caller must keep data alive and in place while the image (or any image it gets moved into) uses it.
+  // Copies of a wrapped image own their pixels. stride is the distance between rows in bytes, 0 means tightly packed
+  static Image wrap(uint32_t width, uint32_t height, uint8_t* data, uint32_t stride = 0, PixelFormat format = PixelFormat::RGBA);
+  void attach(uint32_t width, uint32_t height, uint8_t* data, uint32_t stride = 0, PixelFormat format = PixelFormat::RGBA);
+  bool ownsData() const { return !m_External; }
+
+  // Copies pixels, pixel format and font. Drawing state (clip, transform, blend mode, stencil) stays with the target,
+  // moves carry all of it along
+  Image& operator=(const Image& other);
+  Image& operator=(Image&& other) noexcept {
+    swap(other);
+    return *this;
+  }
+  void swap(Image& other) noexcept;
+
   // Getters
   uint8_t* data() { return m_Data; }
   const uint8_t* data() const { return m_Data; }
   uint32_t width() const { return m_Width; }
   uint32_t height() const { return m_Height; }
   VectorMath::vec2u size() const { return VectorMath::vec2u(m_Width, m_Height); }
+  size_t capacity() const { return m_Capacity; }
+  uint32_t stride() const { return m_Stride; }
+  PixelFormat pixelFormat() const { return m_Format; }
+  uint32_t* row(uint32_t y) { return reinterpret_cast<uint32_t*>(m_Data + static_cast<size_t>(y) * m_Stride); }
+  const uint32_t* row(uint32_t y) const { return reinterpret_cast<const uint32_t*>(m_Data + static_cast<size_t>(y) * m_Stride); }
 
   void setSize(uint32_t width, uint32_t height);
   void setSize(VectorMath::vec2u size) { setSize(size.x, size.y); }
-  void setColorMode(const ColorMode& newColorMode, const ReverseColorMode& newReverseColorMode) { colorMode = newColorMode, reverseColorMode = newReverseColorMode; }
+  void setAllocator(ImageAllocator& allocator);
+  ImageAllocator& getAllocator() { return *m_Allocator; }
+  void setColorMode(const ColorMode& newColorMode, const ReverseColorMode& newReverseColorMode) { colorMode = newColorMode, reverseColorMode = newReverseColorMode, m_Format = PixelFormat::Custom; }
+  void setPixelFormat(PixelFormat format);
   void setFont(Font& newFont) { font = &newFont; }
   Font& getFont() { return *font; }
+  void setBlendMode(BlendMode mode) { m_BlendMode = mode; }
+  BlendMode blendMode() const { return m_BlendMode; }
+
+  // Stencil: allocated on first use and kept at the image size (cleared when the size changes). Every primitive writes into it
+  // or is masked by it depending on the stencil mode, set, setPixel, clear and the pixel moves ignore it
+  void setStencilMode(StencilMode mode);
+  StencilMode stencilMode() const { return m_StencilMode; }
+  Mask& stencil();
+  void clearStencil(uint8_t value = 0) { stencil().clear(value); }
+
+  // Clipping: every primitive draws only inside the innermost pushed rectangle (and the image bounds)
+  void pushClip(VectorMath::Rect<int32_t> rect);
+  void pushClip(int32_t x, int32_t y, int32_t width, int32_t height) { pushClip(VectorMath::Rect<int32_t>(x, y, width, height)); }
+  void popClip();
+  void resetClip() { m_ClipStack.clear(); }
+  VectorMath::Rect<int32_t> clipRect() const;
+  bool clip(VectorMath::Rect<int32_t>& rect) const; // Normalizes a negative size and clips rect, false when nothing is left to draw
+
+  // Transform: maps the coordinates given to the drawing primitives (and clip rects) to pixels. set, get, setPixel, getPixel and clear address pixels directly
+  void pushTransform(const VectorMath::mat3f& transform); // Applied before the current transform, so it works in the current coordinates
+  void popTransform();
+  void resetTransform();
+  void translate(VectorMath::vec2f offset) { pushTransform(VectorMath::mat3f::translation(offset)); }
+  void scale(VectorMath::vec2f factor) { pushTransform(VectorMath::mat3f::scale(factor)); }
+  void rotate(float angle) { pushTransform(VectorMath::mat3f::rotation(angle)); }
+  const VectorMath::mat3f& transform() const { return m_Transform; }
+  bool hasTransform() const { return m_HasTransform; }
 
   // Drawing
-  inline void set(uint32_t x, uint32_t y, Color color) { reinterpret_cast<uint32_t*>(m_Data)[x + (y * m_Width)] = colorMode(color); }
-  inline Color get(uint32_t x, uint32_t y) const { return reverseColorMode(reinterpret_cast<uint32_t*>(m_Data)[x + (y * m_Width)]); }
+  inline void set(uint32_t x, uint32_t y, Color color) { row(y)[x] = colorMode(color); }
+  inline Color get(uint32_t x, uint32_t y) const { return reverseColorMode(row(y)[x]); }
+  uint32_t pack(Color color) const { return colorMode(color); }   // Color in this image's pixel format
+  Color unpack(uint32_t pixel) const { return reverseColorMode(pixel); }
   void setPixel(int32_t x, int32_t y, Color color);
   Color getPixel(int32_t x, int32_t y) const;
 
@@ -105,10 +464,41 @@ public:
   void drawRect(int32_t x, int32_t y, int32_t width, int32_t height, Color color, uint8_t thickness = 3);
   void fillRoundRect(int32_t x, int32_t y, int32_t width, int32_t height, Color color, uint8_t rtl, uint8_t rtr, uint8_t rbl, uint8_t rbr);
   void drawLine(int32_t x1, int32_t y1, int32_t x2, int32_t y2, Color color, uint8_t thickness = 3);
+  void drawLine(VectorMath::vec2f p1, VectorMath::vec2f p2, Color color, const StrokeStyle& style = StrokeStyle());
+  void drawPolyline(const VectorMath::vec2f* points, size_t count, Color color, const StrokeStyle& style = StrokeStyle(), bool closed = false);
+  void fillPath(const Path& path, Color color, FillRule rule = FillRule::NonZero);
+  void fillPath(const Path& path, const Gradient& gradient, FillRule rule = FillRule::NonZero);
+  void fillRect(int32_t x, int32_t y, int32_t width, int32_t height, const Gradient& gradient);
+  void fillRoundRect(int32_t x, int32_t y, int32_t width, int32_t height, const Gradient& gradient, uint8_t rtl, uint8_t rtr, uint8_t rbl, uint8_t rbr);
+  void fillRoundRect(int32_t x, int32_t y, int32_t width, int32_t height, const Gradient& gradient, uint8_t radius = 5) { fillRoundRect(x, y, width, height, gradient, radius, radius, radius, radius); }
+  void fillCircle(VectorMath::vec2f center, float radius, Color color);
+  void drawCircle(VectorMath::vec2f center, float radius, Color color, float thickness = 3);
+  void fillEllipse(VectorMath::vec2f center, VectorMath::vec2f radii, Color color);
+  void drawArc(VectorMath::vec2f center, float radius, float startAngle, float endAngle, Color color, const StrokeStyle& style = StrokeStyle());
+  void strokePath(const Path& path, Color color, const StrokeStyle& style = StrokeStyle());
   void drawImage(const Image& image, int32_t x, int32_t y, int32_t width = 0, int32_t height = 0, uint32_t srcX = 0, uint32_t srcY = 0, uint32_t srcWidth = 0, uint32_t srcHeight = 0);
+  void fillMask(const Mask& mask, int32_t x, int32_t y, Color color);
+  void drawImage(const Image& image, const Mask& mask, int32_t x, int32_t y); // The mask scales the image's alpha, it has the image's size
+  void drawImage(const CompactImage& image, int32_t x, int32_t y);
+  void drawImageRotated(const Image& image, VectorMath::vec2f center, float angle, float scale = 1, bool smooth = false); // Turned around its center, angle in radians. smooth samples bilinearly
+  void drawNineSlice(const Image& image, Insets insets, VectorMath::Rect<int32_t> rect, SliceFill fill = SliceFill::Stretch);
   VectorMath::vec2u drawText(int32_t x, int32_t y, std::string_view text, Color color = Color::white);
   VectorMath::vec2u drawChar(int32_t x, int32_t y, wchar_t character, Color color = Color::white);
-  void clear(Color color = Color::black) { std::fill(reinterpret_cast<uint32_t*>(m_Data), reinterpret_cast<uint32_t*>(m_Data) + m_Width * m_Height, colorMode(color)); }
+  void drawLayer(const Layer& layer); // Composite with the layer's own opacity and blend mode
+  void drawShadow(VectorMath::Rect<int32_t> rect, float radius, Color color, uint8_t cornerRadius = 0); // Gaussian blurred (rounded) rect, cached per radius
+  void drawPoints(const float* x, const float* y, const float* sizes, const Color* colors, size_t count); // Squares centered on (x, y), arrays of count values. sizes may be null for single pixels
+  void drawPoints(const float* x, const float* y, const float* sizes, Color color, size_t count);
+  void fillTriangle(const Vertex& a, const Vertex& b, const Vertex& c, const TriangleStyle& style = TriangleStyle());
+  void drawMesh(const Vertex* vertices, const uint32_t* indices, size_t indexCount, const TriangleStyle& style = TriangleStyle()); // Three indices per triangle. Null indices draw the vertices as a triangle list, indexCount counting vertices
+  void blur(float radius, BlurFilter filter = BlurFilter::Gaussian); // In place. Channels blur independently, so translucent content should be premultiplied (like Layer content)
+  // Color filters cover the whole image and ignore clip, transform, blend mode and stencil
+  void applyColorMatrix(const ColorMatrix& matrix); // In place
+  void applyColorMatrix(const ColorMatrix& matrix, Image& destination) const; // The destination gets this image's size and keeps its pixel format
+  Image resampled(VectorMath::vec2u size, ResampleFilter filter = ResampleFilter::Bilinear) const; // New image of size in this image's pixel format
+  void clear(Color color = Color::black);
+  // Pixel moves inside the image. They address pixels like clear (no transform, no blending), only the destination is clipped
+  void copyRect(int32_t x, int32_t y, int32_t width, int32_t height, int32_t dstX, int32_t dstY); // Overlapping source and destination are fine
+  std::array<VectorMath::Rect<int32_t>, 2> scroll(VectorMath::Rect<int32_t> rect, int32_t dx, int32_t dy); // Moves rect's content, returns the exposed strips to redraw (zero sized when unused)
 
   void fillRoundRect(int32_t x, int32_t y, int32_t width, int32_t height, Color color, uint8_t radius = 5) { fillRoundRect(x, y, width, height, color, radius, radius, radius, radius); }
 
@@ -121,16 +511,27 @@ public:
   void drawRect(VectorMath::vec2i pos, VectorMath::vec2i size, Color color, uint8_t thickness = 3) { drawRect(pos.x, pos.y, size.x, size.y, color, thickness); }
   void fillRoundRect(VectorMath::vec2i pos, VectorMath::vec2i size, Color color, uint8_t rtl, uint8_t rtr, uint8_t rbl, uint8_t rbr) { fillRoundRect(pos.x, pos.y, size.x, size.y, color, rtl, rtr, rbl, rbr); }
   void drawLine(VectorMath::vec2i pos1, VectorMath::vec2i pos2, Color color, uint8_t thickness = 3) { drawLine(pos1.x, pos1.y, pos2.x, pos2.y, color, thickness); }
+  void drawPolyline(const std::vector<VectorMath::vec2f>& points, Color color, const StrokeStyle& style = StrokeStyle(), bool closed = false) { drawPolyline(points.data(), points.size(), color, style, closed); }
+  void drawMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, const TriangleStyle& style = TriangleStyle()) { indices.empty() ? drawMesh(vertices.data(), nullptr, vertices.size(), style) : drawMesh(vertices.data(), indices.data(), indices.size(), style); }
   void drawImage(const Image& image, VectorMath::vec2i pos, VectorMath::vec2i size = 0, VectorMath::vec2u srcPos = 0, VectorMath::vec2u srcSize = 0) { drawImage(image, pos.x, pos.y, size.x, size.y, srcPos.x, srcPos.y, srcSize.x, srcSize.y); }
+  void fillMask(const Mask& mask, VectorMath::vec2i pos, Color color) { fillMask(mask, pos.x, pos.y, color); }
+  void drawImage(const Image& image, const Mask& mask, VectorMath::vec2i pos) { drawImage(image, mask, pos.x, pos.y); }
+  void drawImage(const CompactImage& image, VectorMath::vec2i pos) { drawImage(image, pos.x, pos.y); }
   VectorMath::vec2u drawText(VectorMath::vec2i pos, std::string_view text, Color color = Color::white) { return drawText(pos.x, pos.y, text, color); }
   VectorMath::vec2u drawChar(VectorMath::vec2i pos, wchar_t character, Color color = Color::white) { return drawChar(pos.x, pos.y, character, color); }
 
+  void copyRect(VectorMath::vec2i pos, VectorMath::vec2i size, VectorMath::vec2i dst) { copyRect(pos.x, pos.y, size.x, size.y, dst.x, dst.y); }
+  std::array<VectorMath::Rect<int32_t>, 2> scroll(VectorMath::Rect<int32_t> rect, VectorMath::vec2i offset) { return scroll(rect, offset.x, offset.y); }
+
   void fillRoundRect(VectorMath::vec2i pos, VectorMath::vec2i size, Color color, uint8_t radius = 5) { fillRoundRect(pos.x, pos.y, size.x, size.y, color, radius, radius, radius, radius); }
 
   // Rect alternatives
   void fillRect(VectorMath::Rect<int32_t> rect, Color color) { fillRect(rect.x, rect.y, rect.width, rect.height, color); }
+  void fillRect(VectorMath::Rect<int32_t> rect, const Gradient& gradient) { fillRect(rect.x, rect.y, rect.width, rect.height, gradient); }
+  void fillRoundRect(VectorMath::Rect<int32_t> rect, const Gradient& gradient, uint8_t radius = 5) { fillRoundRect(rect.x, rect.y, rect.width, rect.height, gradient, radius, radius, radius, radius); }
   void drawRect(VectorMath::Rect<int32_t> rect, Color color, uint8_t thickness = 3) { drawRect(rect.x, rect.y, rect.width, rect.height, color, thickness); }
   void fillRoundRect(VectorMath::Rect<int32_t> rect, Color color, uint8_t rtl, uint8_t rtr, uint8_t rbl, uint8_t rbr) { fillRoundRect(rect.x, rect.y, rect.width, rect.height, color, rtl, rtr, rbl, rbr); }
+  void copyRect(VectorMath::Rect<int32_t> rect, VectorMath::vec2i dst) { copyRect(rect.x, rect.y, rect.width, rect.height, dst.x, dst.y); }
   void drawImage(const Image& image, VectorMath::Rect<int32_t> rect, VectorMath::Rect<uint32_t> src = VectorMath::Rect<uint32_t>::zero) { drawImage(image, rect.x, rect.y, rect.width, rect.height, src.x, src.y, src.width, src.height); }
 
   void fillRoundRect(VectorMath::Rect<int32_t> rect, Color color, uint8_t radius = 5) { fillRoundRect(rect.x, rect.y, rect.width, rect.height, color, radius, radius, radius, radius); }
@@ -146,11 +547,205 @@ protected:
 
   uint8_t* m_Data = nullptr;
   uint32_t m_Width = 0, m_Height = 0;
+  uint32_t m_Stride = 0;  // Bytes between rows
+  size_t m_Capacity = 0; // Allocated bytes, setSize reuses the buffer while the new size fits
+  bool m_External = false;
+  PixelFormat m_Format = PixelFormat::RGBA;
+  ImageAllocator* m_Allocator = &getDefaultAllocator();
+  std::vector<VectorMath::Rect<int32_t>> m_ClipStack; // Each entry is already intersected with the ones below it
+  VectorMath::mat3f m_Transform;
+  std::vector<VectorMath::mat3f> m_TransformStack; // Transforms to restore on pop
+  bool m_HasTransform = false;
+  BlendMode m_BlendMode = BlendMode::Over;
+  Mask m_Stencil;
+  StencilMode m_StencilMode = StencilMode::Off;
+
+  bool skipsColor(Color color) const { return color.a == 0 && m_BlendMode != BlendMode::Copy; } // Drawing color changes nothing
   Font* font = nullptr;
 };
+
+// Offscreen image composited with an opacity and a blend mode. Its content is kept until invalidated,
+// so static parts of a frame are rendered once and afterwards only composited
+class Layer {
+public:
+  Layer() = default;
+  Layer(uint32_t width, uint32_t height, VectorMath::vec2i position = 0) : m_Image(width, height), m_Position(position) {}
+  Layer(VectorMath::vec2u size, VectorMath::vec2i position = 0) : Layer(size.x, size.y, position) {}
+
+  // Renders with render(Image&) into the cleared layer when its content is invalid. Returns whether it rendered
+  template <typename Render> bool update(Render render) {
+    if (m_Valid) return false;
+    m_Image.clear(Color::transperent);
+    render(m_Image);
+    m_Valid = true;
+    return true;
+  }
+  void invalidate() { m_Valid = false; }
+  bool valid() const { return m_Valid; }
+
+  Image& image() { return m_Image; } // Drawing into it directly doesn't invalidate, the content is what was drawn
+  const Image& image() const { return m_Image; }
+  void setSize(uint32_t width, uint32_t height);
+  void setSize(VectorMath::vec2u size) { setSize(size.x, size.y); }
+  VectorMath::vec2u size() const { return m_Image.size(); }
+  void setPosition(VectorMath::vec2i position) { m_Position = position; }
+  VectorMath::vec2i position() const { return m_Position; }
+  void setOpacity(float opacity) { m_Opacity = static_cast<uint8_t>(Math::clamp(opacity, 0.f, 1.f) * 255.f + 0.5f); }
+  float opacity() const { return m_Opacity / 255.f; }
+  void setBlendMode(BlendMode mode) { m_BlendMode = mode; }
+  BlendMode blendMode() const { return m_BlendMode; }
+
+  void setVisible(bool visible) { m_Visible = visible; }
+  bool visible() const { return m_Visible; }
+
+protected:
+  friend class Image;
+
+  Image m_Image;
+  VectorMath::vec2i m_Position;
+  uint8_t m_Opacity = 255;
+  BlendMode m_BlendMode = BlendMode::Over;
+  bool m_Valid = false;
+  bool m_Visible = true;
+};
+
+// Packs many small images into a few large pages. Handles stay valid while entries move: remove only frees the handle,
+// the space is reclaimed by repack, which packs every live entry again into as few pages as possible
+class ImageAtlas {
+public:
+  using Handle = uint32_t;
+  static constexpr Handle invalid = UINT32_MAX;
+
+  ImageAtlas(uint32_t pageSize = 1024, uint32_t padding = 1, PixelFormat format = PixelFormat::RGBA);
+  ImageAtlas(const ImageAtlas&) = delete;
+  ImageAtlas& operator=(const ImageAtlas&) = delete;
+
+  Handle add(const Image& image); // Copies the image into the first page it fits in, or a new one
+  std::vector<Handle> add(const std::vector<const Image*>& images); // Packs them together, which packs tighter than one by one
+  void remove(Handle handle);
+  void repack();
+  void clear();
+
+  bool contains(Handle handle) const { return handle < m_Entries.size() && m_Entries[handle].used; }
+  const Image& page(Handle handle) const { return m_Pages[m_Entries[handle].page]->image; } // Page holding the entry
+  VectorMath::Rect<uint32_t> rect(Handle handle) const { return m_Entries[handle].rect; }  // Entry in its page
+  VectorMath::vec2u size(Handle handle) const { return m_Entries[handle].rect.size(); }
+  size_t pageCount() const { return m_Pages.size(); }
+  const Image& pageImage(size_t index) const { return m_Pages[index]->image; }
+  size_t size() const { return m_Entries.size() - m_Free.size(); }
+
+protected:
+  struct Page {
+    Image image;
+    bool shared; // False for a page holding one image larger than the page size
+    stbrp_context context;
+    std::vector<stbrp_node> nodes;
+  };
+  struct Entry {
+    uint32_t page = 0;
+    VectorMath::Rect<uint32_t> rect;
+    bool used = false;
+  };
+
+  Page& addPage(VectorMath::vec2u size, bool shared);
+  void pack(std::vector<stbrp_rect>& rects); // Places rects with handles as ids, in existing pages first
+  bool oversized(VectorMath::vec2u size) const { return size.x + m_Padding > m_PageSize || size.y + m_Padding > m_PageSize; }
+
+  std::vector<std::unique_ptr<Page>> m_Pages; // The packer points into itself, so pages don't move
+  std::vector<Entry> m_Entries;
+  std::vector<Handle> m_Free;
+  uint32_t m_PageSize, m_Padding;
+  PixelFormat m_Format;
+};
+
+// Deferred sprite drawing. Sprites are sorted by depth and then by source image, and drawn in one pass over the target:
+// every band of target rows draws all sprites crossing it, and bands run on separate threads
+class SpriteBatch {
+public:
+  struct Sprite {
+    const Image* image = nullptr;
+    VectorMath::Rect<int32_t> dest;    // Negative sizes mirror, like drawImage
+    VectorMath::Rect<uint32_t> source; // Zero size means the whole image
+    Color tint = Color::white;         // Multiplies the image's channels
+    bool flipX = false, flipY = false;
+    int32_t depth = 0; // Lower depths are drawn first. Within a depth, sprites of different images may be reordered
+  };
+
+  void add(const Sprite& sprite) { m_Sprites.push_back(sprite); }
+  void add(const Image& image, VectorMath::Rect<int32_t> dest, VectorMath::Rect<uint32_t> source = VectorMath::Rect<uint32_t>::zero, Color tint = Color::white, int32_t depth = 0) {
+    Sprite sprite;
+    sprite.image = &image, sprite.dest = dest, sprite.source = source, sprite.tint = tint, sprite.depth = depth;
+    m_Sprites.push_back(sprite);
+  }
+  void add(const Image& image, VectorMath::vec2i position, Color tint = Color::white, int32_t depth = 0) { add(image, VectorMath::Rect<int32_t>(position, image.size()), VectorMath::Rect<uint32_t>::zero, tint, depth); }
+  // Atlas entries are resolved when added, so sprites added before a repack must be added again
+  void add(const ImageAtlas& atlas, ImageAtlas::Handle handle, VectorMath::vec2i position, Color tint = Color::white, int32_t depth = 0) { add(atlas.page(handle), VectorMath::Rect<int32_t>(position, atlas.size(handle)), atlas.rect(handle), tint, depth); }
+  void clear() { m_Sprites.clear(); }
+  size_t size() const { return m_Sprites.size(); }
+
+  void draw(Image& target); // Sprites are kept, so a static batch can be drawn every frame
+
+protected:
+  std::vector<Sprite> m_Sprites;
+  std::vector<uint32_t> m_Order;
+};
+
+// Grid of tiles from a tileset image, drawn from cached chunk images. Changing a tile only marks its chunk,
+// which is rendered again on the next draw, and fully opaque chunks are copied instead of blended
+class Tilemap {
+public:
+  using Tile = uint16_t;
+  static constexpr Tile empty = UINT16_MAX;
+
+  Tilemap(const Image& tileset, VectorMath::vec2u tileSize, VectorMath::vec2u size, uint32_t chunkSize = 16); // Size in tiles, chunkSize in tiles per side
+
+  void set(uint32_t x, uint32_t y, Tile tile);
+  void set(VectorMath::vec2u position, Tile tile) { set(position.x, position.y, tile); }
+  Tile get(uint32_t x, uint32_t y) const { return m_Tiles[y * m_Size.x + x]; }
+  Tile get(VectorMath::vec2u position) const { return get(position.x, position.y); }
+  void fill(VectorMath::Rect<uint32_t> area, Tile tile);
+  void invalidate(); // Renders every chunk again, after the tileset's pixels changed
+
+  void draw(Image& target, VectorMath::vec2i position = 0); // Top left of the map at position, scroll by moving it
+
+  VectorMath::vec2u size() const { return m_Size; }
+  VectorMath::vec2u tileSize() const { return m_TileSize; }
+  VectorMath::vec2u pixelSize() const { return m_Size * m_TileSize; }
+  const Image& tileset() const { return *m_Tileset; }
+
+protected:
+  struct Chunk {
+    Image image;
+    bool dirty = true;
+    bool blank = true;   // Only empty tiles, nothing to draw
+    bool opaque = false; // Only opaque tiles, copied instead of blended
+  };
+
+  void render(Chunk& chunk, VectorMath::vec2u index);
+
+  const Image* m_Tileset;
+  VectorMath::vec2u m_TileSize, m_Size, m_ChunkCount;
+  uint32_t m_ChunkSize;
+  uint32_t m_Columns; // Tiles per tileset row
+  std::vector<Tile> m_Tiles;
+  std::vector<bool> m_OpaqueTiles;
+  std::vector<Chunk> m_Chunks;
+  PixelFormat m_Format; // Chunks follow the target's format, so they blit without conversion
+};
 } // namespace Mova
 
 using MvColor = Mova::Color;
+using MvColorMatrix = Mova::ColorMatrix;
 using MvImage = Mova::Image;
 using MvFont = Mova::Font;
 using MvColorMode = Mova::ColorMode;
+using MvPath = Mova::Path;
+using MvGradient = Mova::Gradient;
+using MvLayer = Mova::Layer;
+using MvMask = Mova::Mask;
+using MvCompactImage = Mova::CompactImage;
+using MvImageAtlas = Mova::ImageAtlas;
+using MvSpriteBatch = Mova::SpriteBatch;
+using MvTilemap = Mova::Tilemap;
+using MvDepthBuffer = Mova::DepthBuffer;
+using MvVertex = Mova::Vertex;
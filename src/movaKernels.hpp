@@ -0,0 +1,576 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <lib/OreonMath.hpp>
+#include <movaImage.hpp>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+--- Span kernels shared by the Image primitives ---
+Pixels are blended in the image's packed format: the built-in color modes only swap R and B, so the alpha is always the top byte
+*/
+
+namespace Mova {
+namespace Kernels {
+// * x * y / 255, rounded
+inline uint32_t mul255(uint32_t x, uint32_t y) {
+  uint32_t t = x * y + 128;
+  return (t + (t >> 8)) >> 8;
+}
+
+// * Source-over with an explicit alpha (the alpha byte of src is ignored). Blends R|B and G in two 32-bit lanes
+inline uint32_t blendOver(uint32_t dst, uint32_t src, uint32_t alpha) {
+  const uint32_t a = alpha + (alpha >> 7), ia = 256 - a;
+  const uint32_t rb = (((src & 0x00FF00FF) * a + (dst & 0x00FF00FF) * ia) >> 8) & 0x00FF00FF;
+  const uint32_t g = (((src & 0x0000FF00) * a + (dst & 0x0000FF00) * ia) >> 8) & 0x0000FF00;
+  return rb | g | ((alpha + mul255(dst >> 24, 255 - alpha)) << 24);
+}
+
+inline uint32_t swapRB(uint32_t color) { return (color & 0xFF00FF00) | ((color >> 16) & 0xFF) | ((color & 0xFF) << 16); }
+
+// * Blend modes. apply(dst, src, coverage) blends a packed source, whose alpha is scaled by 8-bit coverage, onto a packed destination.
+// skips(src) is true when a source leaves every pixel unchanged and replaces(src) when a fully covered pixel just becomes src
+namespace Blend {
+// Separable modes mix every color channel with channel(dst, src), then fade that in over dst by the source alpha
+template <typename Channel> inline uint32_t separable(uint32_t dst, uint32_t src, uint32_t coverage, Channel channel) {
+  uint32_t mixed = 0;
+  for (uint32_t shift = 0; shift < 24; shift += 8) mixed |= channel((dst >> shift) & 0xFF, (src >> shift) & 0xFF) << shift;
+  return blendOver(dst, mixed, mul255(src >> 24, coverage));
+}
+
+struct Over {
+  static bool skips(uint32_t src) { return (src >> 24) == 0; }
+  static bool replaces(uint32_t src) { return (src >> 24) == 255; }
+  static uint32_t apply(uint32_t dst, uint32_t src, uint32_t coverage) { return blendOver(dst, src, mul255(src >> 24, coverage)); }
+};
+
+// Replaces all four channels, coverage fades between dst and src
+struct Copy {
+  static bool skips(uint32_t) { return false; }
+  static bool replaces(uint32_t) { return true; }
+  static uint32_t apply(uint32_t dst, uint32_t src, uint32_t coverage) {
+    const uint32_t a = coverage + (coverage >> 7), ia = 256 - a;
+    const uint32_t rb = (((src & 0x00FF00FF) * a + (dst & 0x00FF00FF) * ia) >> 8) & 0x00FF00FF;
+    const uint32_t ag = (((src >> 8) & 0x00FF00FF) * a + ((dst >> 8) & 0x00FF00FF) * ia) & 0xFF00FF00;
+    return rb | ag;
+  }
+};
+
+struct Add {
+  static bool skips(uint32_t src) { return (src >> 24) == 0; }
+  static bool replaces(uint32_t) { return false; }
+  static uint32_t apply(uint32_t dst, uint32_t src, uint32_t coverage) {
+    return separable(dst, src, coverage, [](uint32_t d, uint32_t s) { return Math::min(d + s, 255u); });
+  }
+};
+
+struct Multiply {
+  static bool skips(uint32_t src) { return (src >> 24) == 0; }
+  static bool replaces(uint32_t) { return false; }
+  static uint32_t apply(uint32_t dst, uint32_t src, uint32_t coverage) { return separable(dst, src, coverage, mul255); }
+};
+
+struct Screen {
+  static bool skips(uint32_t src) { return (src >> 24) == 0; }
+  static bool replaces(uint32_t) { return false; }
+  static uint32_t apply(uint32_t dst, uint32_t src, uint32_t coverage) {
+    return separable(dst, src, coverage, [](uint32_t d, uint32_t s) { return d + s - mul255(d, s); });
+  }
+};
+
+struct Min {
+  static bool skips(uint32_t src) { return (src >> 24) == 0; }
+  static bool replaces(uint32_t) { return false; }
+  static uint32_t apply(uint32_t dst, uint32_t src, uint32_t coverage) {
+    return separable(dst, src, coverage, [](uint32_t d, uint32_t s) { return Math::min(d, s); });
+  }
+};
+
+struct Max {
+  static bool skips(uint32_t src) { return (src >> 24) == 0; }
+  static bool replaces(uint32_t) { return false; }
+  static uint32_t apply(uint32_t dst, uint32_t src, uint32_t coverage) {
+    return separable(dst, src, coverage, [](uint32_t d, uint32_t s) { return Math::max(d, s); });
+  }
+};
+
+// Flips the destination's color bits that are set in the source, so drawing the same thing twice restores it
+struct Xor {
+  static bool skips(uint32_t src) { return (src >> 24) == 0; }
+  static bool replaces(uint32_t) { return false; }
+  static uint32_t apply(uint32_t dst, uint32_t src, uint32_t coverage) {
+    const uint32_t alpha = mul255(src >> 24, coverage);
+    return alpha >= 128 ? dst ^ (src & 0x00FFFFFF) : dst;
+  }
+};
+} // namespace Blend
+
+// * Calls function with the tag of a blend mode, so every primitive is compiled once per mode and the mode is picked once per draw call
+template <typename Function> inline void withBlendMode(BlendMode mode, Function function) {
+  switch (mode) {
+  case BlendMode::Over: return function(Blend::Over());
+  case BlendMode::Copy: return function(Blend::Copy());
+  case BlendMode::Add: return function(Blend::Add());
+  case BlendMode::Multiply: return function(Blend::Multiply());
+  case BlendMode::Screen: return function(Blend::Screen());
+  case BlendMode::Min: return function(Blend::Min());
+  case BlendMode::Max: return function(Blend::Max());
+  case BlendMode::Xor: return function(Blend::Xor());
+  }
+}
+
+// * Stencil under a span, indexed like the span's pixels. Null data draws without stencil
+struct StencilSpan {
+  uint8_t* data = nullptr;
+  StencilMode mode = StencilMode::Off;
+  StencilSpan operator+(int32_t offset) const { return data ? StencilSpan{data + offset, mode} : StencilSpan(); }
+};
+
+// * The stencil of one draw call, looked up once and shared by every span (and thread) of it
+class Stencil {
+public:
+  explicit Stencil(Image& image) : m_Mode(image.stencilMode()) {
+    if (m_Mode != StencilMode::Off) m_Mask = &image.stencil();
+  }
+  StencilSpan span(int32_t x, int32_t y) const { return m_Mask ? StencilSpan{m_Mask->row(y) + x, m_Mode} : StencilSpan(); }
+
+private:
+  StencilMode m_Mode;
+  Mask* m_Mask = nullptr;
+};
+
+// * Blend one pixel through coverage and its stencil byte. Write mode raises the stencil to the drawn alpha instead
+template <typename Mode> inline void stencilPixel(uint32_t& dst, uint8_t& stencil, StencilMode mode, uint32_t src, uint32_t coverage) {
+  if (mode == StencilMode::Write) {
+    stencil = static_cast<uint8_t>(Math::max<uint32_t>(stencil, mul255(src >> 24, coverage)));
+    return;
+  }
+  coverage = mul255(coverage, mode == StencilMode::Inside ? stencil : 255 - stencil);
+  if (coverage == 255 && Mode::replaces(src)) dst = src;
+  else if (coverage != 0 && !Mode::skips(src)) dst = Mode::apply(dst, src, coverage);
+}
+
+// * The stencil path of the span kernels: source(i) is the packed color and coverage(i) the coverage of pixel i, and
+// plain(begin, end) draws pixels [begin, end) without stencil. The stencil is checked 8 pixels at a time like coverage,
+// so groups it hides cost one compare and runs of groups it fully shows go through the unmasked kernel
+template <typename Mode, typename Source, typename Coverage, typename Plain>
+inline void stencilSpan(uint32_t* dst, uint32_t count, StencilSpan stencil, Source source, Coverage coverage, Plain plain) {
+  uint32_t i = 0;
+  if (stencil.mode != StencilMode::Write) {
+    const uint64_t hidden = stencil.mode == StencilMode::Inside ? 0 : ~uint64_t(0), shown = ~hidden;
+    uint32_t run = 0;
+    for (; i + 8 <= count; i += 8) {
+      uint64_t group;
+      std::memcpy(&group, stencil.data + i, sizeof(group));
+      if (group == shown) continue;
+      if (run < i) plain(run, i);
+      run = i + 8;
+      if (group == hidden) continue;
+      for (uint32_t j = i; j < i + 8; j++) stencilPixel<Mode>(dst[j], stencil.data[j], stencil.mode, source(j), coverage(j));
+    }
+    if (run < i) plain(run, i);
+  }
+  for (; i < count; i++) stencilPixel<Mode>(dst[i], stencil.data[i], stencil.mode, source(i), coverage(i));
+}
+
+// * Fill count pixels with a packed color
+template <typename Mode = Blend::Over> inline void fillSpan(uint32_t* dst, uint32_t count, uint32_t color, StencilSpan stencil = StencilSpan()) {
+  if (Mode::skips(color)) return;
+  if (stencil.data) {
+    return stencilSpan<Mode>(dst, count, stencil, [=](uint32_t) { return color; }, [](uint32_t) { return 255u; },
+                             [=](uint32_t begin, uint32_t end) { fillSpan<Mode>(dst + begin, end - begin, color); });
+  }
+  if (Mode::replaces(color)) std::fill(dst, dst + count, color);
+  else {
+    for (uint32_t i = 0; i < count; i++) dst[i] = Mode::apply(dst[i], color, 255);
+  }
+}
+
+// * Blend a row of packed colors, each with its own alpha
+template <typename Mode = Blend::Over> inline void blendSpan(uint32_t* dst, const uint32_t* src, uint32_t count, StencilSpan stencil = StencilSpan()) {
+  if (stencil.data) {
+    return stencilSpan<Mode>(dst, count, stencil, [=](uint32_t i) { return src[i]; }, [](uint32_t) { return 255u; },
+                             [=](uint32_t begin, uint32_t end) { blendSpan<Mode>(dst + begin, src + begin, end - begin); });
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    if (Mode::replaces(src[i])) dst[i] = src[i];
+    else if (!Mode::skips(src[i])) dst[i] = Mode::apply(dst[i], src[i], 255);
+  }
+}
+
+// * Blend a row of packed colors through 8-bit coverage, skipping empty and solid groups of 8 like fillSpanMask
+template <typename Mode = Blend::Over> inline void blendSpanMask(uint32_t* dst, const uint32_t* src, const uint8_t* coverage, uint32_t count, StencilSpan stencil = StencilSpan()) {
+  if (stencil.data) {
+    return stencilSpan<Mode>(dst, count, stencil, [=](uint32_t i) { return src[i]; }, [=](uint32_t i) { return uint32_t(coverage[i]); },
+                             [=](uint32_t begin, uint32_t end) { blendSpanMask<Mode>(dst + begin, src + begin, coverage + begin, end - begin); });
+  }
+  uint32_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    uint64_t group;
+    std::memcpy(&group, coverage + i, sizeof(group));
+    if (group == 0) continue;
+    if (group == ~uint64_t(0)) {
+      blendSpan<Mode>(dst + i, src + i, 8);
+      continue;
+    }
+    for (uint32_t j = i; j < i + 8; j++) {
+      if (coverage[j] != 0) dst[j] = Mode::apply(dst[j], src[j], coverage[j]);
+    }
+  }
+  for (; i < count; i++) {
+    if (coverage[i] != 0) dst[i] = Mode::apply(dst[i], src[i], coverage[i]);
+  }
+}
+
+// * Blend a packed color through 8-bit coverage
+// Coverage is mostly empty or solid, so it is checked 8 pixels at a time and only partial groups are blended per pixel
+template <typename Mode = Blend::Over> inline void fillSpanMask(uint32_t* dst, const uint8_t* coverage, uint32_t count, uint32_t color, StencilSpan stencil = StencilSpan()) {
+  if (Mode::skips(color)) return;
+  if (stencil.data) {
+    return stencilSpan<Mode>(dst, count, stencil, [=](uint32_t) { return color; }, [=](uint32_t i) { return uint32_t(coverage[i]); },
+                             [=](uint32_t begin, uint32_t end) { fillSpanMask<Mode>(dst + begin, coverage + begin, end - begin, color); });
+  }
+  uint32_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    uint64_t group;
+    std::memcpy(&group, coverage + i, sizeof(group));
+    if (group == 0) continue;
+    if (group == ~uint64_t(0)) {
+      fillSpan<Mode>(dst + i, 8, color);
+      continue;
+    }
+    for (uint32_t j = i; j < i + 8; j++) {
+      if (coverage[j] != 0) dst[j] = Mode::apply(dst[j], color, coverage[j]);
+    }
+  }
+  for (; i < count; i++) {
+    if (coverage[i] != 0) dst[i] = Mode::apply(dst[i], color, coverage[i]);
+  }
+}
+
+// * Straight-alpha color of a premultiplied pixel
+inline uint32_t unpremultiply(uint32_t pixel) {
+  const uint32_t alpha = pixel >> 24;
+  if (alpha == 255 || alpha == 0) return pixel;
+  uint32_t result = pixel & 0xFF000000;
+  for (uint32_t shift = 0; shift < 24; shift += 8) result |= Math::min((((pixel >> shift) & 0xFF) * 255 + alpha / 2) / alpha, 255u) << shift;
+  return result;
+}
+
+// * Composite a row of premultiplied pixels, which is what drawing onto a transparent image produces, with an extra opacity.
+// Over is done premultiplied, the other modes get the straight color back first
+template <typename Mode> inline void compositeSpan(uint32_t* dst, const uint32_t* src, uint32_t count, uint32_t opacity, StencilSpan stencil = StencilSpan()) {
+  if (stencil.data) {
+    return stencilSpan<Mode>(dst, count, stencil, [=](uint32_t i) { return unpremultiply(src[i]); }, [=](uint32_t) { return opacity; },
+                             [=](uint32_t begin, uint32_t end) { compositeSpan<Mode>(dst + begin, src + begin, end - begin, opacity); });
+  }
+  if (std::is_same<Mode, Blend::Over>::value) {
+    const uint32_t o = opacity + (opacity >> 7);
+    for (uint32_t i = 0; i < count; i++) {
+      const uint32_t rb = (((src[i] & 0x00FF00FF) * o) >> 8) & 0x00FF00FF;
+      const uint32_t ag = (((src[i] >> 8) & 0x00FF00FF) * o) & 0xFF00FF00;
+      const uint32_t alpha = ag >> 24, ia = 256 - (alpha + (alpha >> 7));
+      const uint32_t color = (rb | (ag & 0x0000FF00)) + ((((dst[i] & 0x00FF00FF) * ia) >> 8) & 0x00FF00FF) + ((((dst[i] & 0x0000FF00) * ia) >> 8) & 0x0000FF00);
+      dst[i] = color | (alpha + mul255(dst[i] >> 24, 255 - alpha)) << 24;
+    }
+    return;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    const uint32_t color = unpremultiply(src[i]);
+    if (!Mode::skips(color)) dst[i] = Mode::apply(dst[i], color, opacity);
+  }
+}
+
+// * Scratch A8 canvas for primitives that build coverage from several pieces (strokes with joins, paths).
+// Pieces are combined with max(), so overlaps are blended once. Only touched spans are flushed and cleared afterwards
+class CoverageBuffer {
+public:
+  void begin(VectorMath::Rect<int32_t> bounds) {
+    m_Bounds = bounds;
+    const size_t size = static_cast<size_t>(bounds.width) * bounds.height;
+    if (m_Data.size() < size) m_Data.resize(size, 0);
+    m_Spans.assign(bounds.height, Span{bounds.x + bounds.width, bounds.x});
+  }
+
+  const VectorMath::Rect<int32_t>& bounds() const { return m_Bounds; }
+
+  // Row pointer indexable by absolute x
+  uint8_t* row(int32_t y) { return m_Data.data() + static_cast<size_t>(y - m_Bounds.y) * m_Bounds.width - m_Bounds.x; }
+
+  void touch(int32_t y, int32_t x0, int32_t x1) {
+    Span& span = m_Spans[y - m_Bounds.y];
+    span.x0 = Math::min(span.x0, x0);
+    span.x1 = Math::max(span.x1, x1);
+  }
+
+  void add(uint8_t* row, int32_t x, uint32_t coverage) {
+    if (coverage > row[x]) row[x] = static_cast<uint8_t>(coverage);
+  }
+
+  // Blend the accumulated coverage into image with a packed color, in the image's blend mode
+  void flush(Image& image, uint32_t color) {
+    withBlendMode(image.blendMode(), [&](auto mode) {
+      using Mode = decltype(mode);
+      const Stencil stencil(image);
+      flushSpans([&](int32_t x, int32_t y, uint32_t count, const uint8_t* coverage) { fillSpanMask<Mode>(image.row(y) + x, coverage, count, color, stencil.span(x, y)); });
+    });
+  }
+
+  // Add the accumulated coverage to an A8 mask, keeping the maximum
+  void flush(Mask& mask) {
+    flushSpans([&](int32_t x, int32_t y, uint32_t count, const uint8_t* coverage) {
+      uint8_t* row = mask.row(y) + x;
+      for (uint32_t i = 0; i < count; i++) row[i] = Math::max(row[i], coverage[i]);
+    });
+  }
+
+  // Blend the accumulated coverage into image with colors from a shader (shade(x, y, count, out))
+  template <typename Shader> void flushShaded(Image& image, const Shader& shader) {
+    withBlendMode(image.blendMode(), [&](auto mode) {
+      using Mode = decltype(mode);
+      const Stencil stencil(image);
+      flushSpans([&](int32_t x, int32_t y, uint32_t count, const uint8_t* coverage) {
+        if (m_Colors.size() < count) m_Colors.resize(count);
+        shader.shade(x, y, count, m_Colors.data());
+        blendSpanMask<Mode>(image.row(y) + x, m_Colors.data(), coverage, count, stencil.span(x, y));
+      });
+    });
+  }
+
+private:
+  struct Span {
+    int32_t x0, x1;
+  };
+
+  template <typename Blend> void flushSpans(Blend blend) {
+    for (int32_t i = 0; i < m_Bounds.height; i++) {
+      const Span& span = m_Spans[i];
+      if (span.x0 >= span.x1) continue;
+      const int32_t y = m_Bounds.y + i;
+      uint8_t* coverage = row(y);
+      blend(span.x0, y, span.x1 - span.x0, coverage + span.x0);
+      std::memset(coverage + span.x0, 0, span.x1 - span.x0);
+    }
+  }
+
+  VectorMath::Rect<int32_t> m_Bounds;
+  std::vector<uint8_t> m_Data;
+  std::vector<Span> m_Spans;
+  std::vector<uint32_t> m_Colors;
+};
+
+// * Converts packed pixels from one image's format to another's
+class PixelConverter {
+public:
+  PixelConverter(const Image& from, const Image& to) : m_From(from), m_To(to) {
+    const bool builtIn = from.pixelFormat() != PixelFormat::Custom && to.pixelFormat() != PixelFormat::Custom;
+    m_Mode = !builtIn ? Mode::Generic : from.pixelFormat() == to.pixelFormat() ? Mode::Same : Mode::Swap;
+  }
+  uint32_t operator()(uint32_t pixel) const {
+    if (m_Mode == Mode::Same) return pixel;
+    if (m_Mode == Mode::Swap) return swapRB(pixel);
+    return m_To.pack(m_From.unpack(pixel));
+  }
+
+private:
+  enum class Mode { Same, Swap, Generic };
+  const Image& m_From;
+  const Image& m_To;
+  Mode m_Mode;
+};
+
+// * RGB565 to and from packed 32-bit pixels. BGRA says whether the 32-bit side has R and B swapped, so the branch is
+// compiled out of the span loops. 8-bit channels are rounded to 5 and 6 bits, and expanded back by replicating the top bits
+template <bool BGRA> inline uint16_t to565(uint32_t pixel) {
+  const uint32_t r = BGRA ? (pixel >> 16) & 0xFF : pixel & 0xFF, g = (pixel >> 8) & 0xFF, b = BGRA ? pixel & 0xFF : (pixel >> 16) & 0xFF;
+  return static_cast<uint16_t>(((r * 249 + 1014) >> 11) << 11 | ((g * 253 + 505) >> 10) << 5 | (b * 249 + 1014) >> 11);
+}
+
+template <bool BGRA> inline uint32_t from565(uint16_t pixel) {
+  const uint32_t r = pixel >> 11, g = (pixel >> 5) & 0x3F, b = pixel & 0x1F;
+  const uint32_t r8 = (r << 3) | (r >> 2), g8 = (g << 2) | (g >> 4), b8 = (b << 3) | (b >> 2);
+  return 0xFF000000 | (BGRA ? (r8 << 16 | g8 << 8 | b8) : (b8 << 16 | g8 << 8 | r8));
+}
+
+template <bool BGRA> inline void packSpan565(uint16_t* dst, const uint32_t* src, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) dst[i] = to565<BGRA>(src[i]);
+}
+
+template <bool BGRA> inline void expandSpan565(uint32_t* dst, const uint16_t* src, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) dst[i] = from565<BGRA>(src[i]);
+}
+
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+// * Workers that stay alive between jobs, so a parallel draw doesn't pay for starting threads. A job runs band(i) for every
+// band i, the submitting thread takes bands too. Workers only ever wait for the next job, the submitter for its bands
+class ThreadPool {
+public:
+  // Pool of every parallelFor, started by the first job that needs it
+  static ThreadPool& shared(uint32_t workers) {
+    static ThreadPool pool(workers);
+    return pool;
+  }
+
+  explicit ThreadPool(uint32_t workers) {
+    for (uint32_t i = 0; i < workers; i++) m_Workers.emplace_back([this] { work(); });
+  }
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(m_Mutex);
+      m_Stop = true;
+    }
+    m_Wake.notify_all();
+    for (std::thread& worker : m_Workers) worker.join();
+  }
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Runs band(0) to band(count - 1) and waits for them. False without running anything when called from inside a job
+  // or while another thread's job runs, the caller then does the work itself
+  template <typename Band> bool run(uint32_t count, const Band& band) {
+    if (insideJob()) return false;
+    std::unique_lock<std::mutex> submit(m_Submit, std::try_to_lock);
+    if (!submit.owns_lock()) return false;
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    m_Job = &band, m_Call = [](const void* job, uint32_t index) { (*static_cast<const Band*>(job))(index); };
+    m_Count = count, m_Next = 0, m_Pending = count, m_Generation++;
+    m_Wake.notify_all();
+    insideJob() = true;
+    runBands(lock);
+    insideJob() = false;
+    m_Done.wait(lock, [&] { return m_Pending == 0; });
+    m_Job = nullptr;
+    return true;
+  }
+
+private:
+  using Call = void (*)(const void* job, uint32_t index);
+
+  static bool& insideJob() {
+    static thread_local bool inside = false;
+    return inside;
+  }
+
+  // Takes bands of the current job until none are left. The lock is held except while a band runs
+  void runBands(std::unique_lock<std::mutex>& lock) {
+    while (m_Next < m_Count) {
+      const uint32_t index = m_Next++;
+      const void* job = m_Job;
+      const Call call = m_Call;
+      lock.unlock();
+      call(job, index);
+      lock.lock();
+      if (--m_Pending == 0) m_Done.notify_all();
+    }
+  }
+
+  void work() {
+    insideJob() = true;
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    uint64_t seen = m_Generation;
+    for (;;) {
+      m_Wake.wait(lock, [&] { return m_Stop || m_Generation != seen; });
+      if (m_Stop) return;
+      seen = m_Generation;
+      runBands(lock);
+    }
+  }
+
+  std::vector<std::thread> m_Workers;
+  std::mutex m_Submit; // One job at a time
+  std::mutex m_Mutex;  // Guards everything below
+  std::condition_variable m_Wake, m_Done;
+  const void* m_Job = nullptr;
+  Call m_Call = nullptr;
+  uint32_t m_Count = 0, m_Next = 0, m_Pending = 0;
+  uint64_t m_Generation = 0;
+  bool m_Stop = false;
+};
+#endif
+
+// * Per-thread storage of a draw call that its parallelFor bands read, kept between calls so it doesn't reallocate.
+// T must be a type of the caller's own, so no two callers share it. The bands have to use the returned reference:
+// a thread_local named inside a band is the worker's own. Scratch a band only uses itself can be its own thread_local
+template <typename T> T& callScratch() {
+  static thread_local T scratch;
+  return scratch;
+}
+
+// * Runs function(begin, end) over [0, count) split into one contiguous band per hardware thread (at most 8), on the
+// shared ThreadPool. Jobs with fewer than minimum items per band stay on the calling thread, as do nested jobs, jobs
+// submitted while another thread's job runs and builds without threads
+template <typename Function> void parallelFor(uint32_t count, uint32_t minimum, Function function) {
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+  function(0u, count);
+#else
+  const uint32_t hardware = Math::clamp(std::thread::hardware_concurrency(), 1u, 8u);
+  const uint32_t bands = Math::min(hardware, Math::max(count / Math::max(minimum, 1u), 1u));
+  if (bands <= 1) return function(0u, count);
+  const auto band = [&](uint32_t i) { function(static_cast<uint32_t>(uint64_t(count) * i / bands), static_cast<uint32_t>(uint64_t(count) * (i + 1) / bands)); };
+  if (!ThreadPool::shared(hardware - 1).run(bands, band)) function(0u, count);
+#endif
+}
+
+// * Textured convex quad under a general affine transform. The quad's edges are walked once per row for the covered span,
+// along which the source position steps incrementally. sample(u, v) gets the source position of the pixel center and returns a packed color
+template <typename Mode, typename Sampler> void rasterizeQuadIn(Image& image, const VectorMath::vec2f (&corners)[4], const VectorMath::mat3f& toSource, const Sampler& sample) {
+  VectorMath::vec2f minP = corners[0], maxP = corners[0];
+  for (const VectorMath::vec2f& corner : corners) minP = VectorMath::min(minP, corner), maxP = VectorMath::max(maxP, corner);
+  const VectorMath::Rect<int32_t> clip = image.clipRect();
+  const int32_t y0 = Math::max(static_cast<int32_t>(floorf(minP.y)), clip.top()), y1 = Math::min(static_cast<int32_t>(ceilf(maxP.y)), clip.bottom());
+  const VectorMath::vec2f step = toSource.transformVector(VectorMath::vec2f(1, 0));
+  const Stencil stencil(image);
+
+  for (int32_t y = y0; y < y1; y++) {
+    const float center = y + 0.5f;
+    float left = maxP.x, right = minP.x;
+    for (uint32_t i = 0; i < 4; i++) {
+      const VectorMath::vec2f& a = corners[i];
+      const VectorMath::vec2f& b = corners[(i + 1) & 3];
+      if ((a.y <= center) == (b.y <= center)) continue;
+      const float x = a.x + (center - a.y) * (b.x - a.x) / (b.y - a.y);
+      left = Math::min(left, x), right = Math::max(right, x);
+    }
+    // Pixels whose centers fall inside [left, right)
+    const int32_t x0 = Math::max(static_cast<int32_t>(ceilf(left - 0.5f)), clip.left());
+    const int32_t x1 = Math::min(static_cast<int32_t>(ceilf(right - 0.5f)), clip.right());
+    if (x0 >= x1) continue;
+
+    uint32_t* row = image.row(y);
+    const StencilSpan masked = stencil.span(0, y);
+    VectorMath::vec2f source = toSource * VectorMath::vec2f(x0 + 0.5f, center);
+    for (int32_t x = x0; x < x1; x++, source += step) {
+      const uint32_t color = sample(source.x, source.y);
+      if (masked.data) stencilPixel<Mode>(row[x], masked.data[x], masked.mode, color, 255);
+      else if (Mode::replaces(color)) row[x] = color;
+      else if (!Mode::skips(color)) row[x] = Mode::apply(row[x], color, 255);
+    }
+  }
+}
+
+// Picks the blend mode once per quad
+template <typename Sampler> void rasterizeQuad(Image& image, const VectorMath::vec2f (&corners)[4], const VectorMath::mat3f& toSource, const Sampler& sample) {
+  withBlendMode(image.blendMode(), [&](auto mode) { rasterizeQuadIn<decltype(mode)>(image, corners, toSource, sample); });
+}
+
+// * Produces gradient colors packed for one image, implemented in movaGradient.cpp
+class GradientShader {
+public:
+  GradientShader(const Gradient& gradient, const Image& image);
+  void shade(int32_t x, int32_t y, uint32_t count, uint32_t* out) const;
+
+private:
+  float position(float t) const;
+
+  const Gradient& m_Gradient;
+  const Image& m_Image;
+  VectorMath::mat3f m_ToGradient; // Pixels to the space the gradient was defined in
+  uint32_t m_Packed[256];
+};
+} // namespace Kernels
+} // namespace Mova
@@ -0,0 +1,299 @@
+#include "lib/OreonMath.hpp"
+#include "lib/logassert.h"
+#include "movaImage.hpp"
+#include "movaKernels.hpp"
+#include <cmath>
+
+/*
+--- Triangle rasterizer ---
+Half-space rasterizer: a pixel is inside when the three edge functions at its center are positive. Edges are set up in
+24.8 fixed point, so neighbouring triangles share their edge pixels exactly once (top-left rule). Triangles are binned
+into tiles, tiles run on threads, and inside a tile 8x8 blocks are rejected or accepted whole from their corners before
+any pixel is tested. Attributes are planes over the image: depth is linear, and uv and colors are interpolated divided
+by w and multiplied back per pixel, which makes them perspective correct
+*/
+
+using namespace VectorMath;
+
+namespace Mova {
+#pragma region DepthBuffer
+void DepthBuffer::setSize(uint32_t width, uint32_t height) {
+  m_Width = width, m_Height = height;
+  m_Data.assign(static_cast<size_t>(width) * height, INFINITY);
+}
+
+void DepthBuffer::clear(float depth) { std::fill(m_Data.begin(), m_Data.end(), depth); }
+#pragma endregion DepthBuffer
+
+#pragma region Rasterizer
+static constexpr int32_t subpixelBits = 8;
+static constexpr int32_t tileSize = 64, blockSize = 8;
+// Larger coordinates could overflow the fixed point edge functions, triangles reaching them are skipped
+static constexpr float coordinateLimit = 1 << 22;
+// Meshes covering fewer pixels than this stay on the calling thread
+static constexpr uint64_t parallelPixels = 1 << 18;
+
+// * Attribute a + dx * x + dy * y over image pixel centers. Evaluated in double, far from the origin the terms cancel out
+struct Plane {
+  double a = 0, dx = 0, dy = 0;
+  float at(int32_t x, int32_t y) const { return static_cast<float>(a + dx * x + dy * y); }
+};
+
+struct Edge {
+  int64_t stepX, stepY; // Change per pixel in x and y
+  int64_t origin;       // Value at the center of pixel (0, 0), top-left rule bias included
+  int64_t at(int32_t x, int32_t y) const { return origin + stepX * x + stepY * y; }
+};
+
+// A triangle ready to rasterize
+struct SetupTriangle {
+  Edge edges[3];
+  Rect<int32_t> bounds; // Pixels, clipped
+  Plane depth, inverseW, u, v, color[4];
+  uint32_t flatColor; // RGBA order
+};
+
+// Set up triangles of a mesh, and the indices of the ones touching every tile
+struct MeshScratch {
+  std::vector<SetupTriangle> triangles;
+  std::vector<std::vector<uint32_t>> tiles;
+};
+
+static Edge setupEdge(int64_t ax, int64_t ay, int64_t bx, int64_t by) {
+  // E(p) = (b - a) x (p - a), positive inside for triangles wound clockwise on the image
+  const int64_t dx = bx - ax, dy = by - ay;
+  Edge edge;
+  edge.stepX = -dy * (1 << subpixelBits);
+  edge.stepY = dx * (1 << subpixelBits);
+  const int64_t half = 1 << (subpixelBits - 1);
+  edge.origin = dx * (half - ay) - dy * (half - ax);
+  // Top-left rule: pixels exactly on a top or left edge are inside, on other edges outside
+  const bool topLeft = (dy == 0 && dx > 0) || dy < 0;
+  if (!topLeft) edge.origin -= 1;
+  return edge;
+}
+
+static Plane setupPlane(const float (&values)[3], const double (&lambdaX)[3], const double (&lambdaY)[3], const double (&lambdaOrigin)[3]) {
+  Plane plane;
+  for (uint32_t i = 0; i < 3; i++) plane.a += values[i] * lambdaOrigin[i], plane.dx += values[i] * lambdaX[i], plane.dy += values[i] * lambdaY[i];
+  return plane;
+}
+
+// * Sets up the triangle, false when nothing of it can be drawn
+static bool setupTriangle(const Image& image, const Vertex* (&corners)[3], const TriangleStyle& style, const Rect<int32_t>& clip, SetupTriangle& out) {
+  vec2f points[3];
+  for (uint32_t i = 0; i < 3; i++) {
+    const Vertex& vertex = *corners[i];
+    if (!(vertex.w > 0)) return false;
+    points[i] = image.hasTransform() ? image.transform() * vec2f(vertex.position.x, vertex.position.y) : vec2f(vertex.position.x, vertex.position.y);
+    if (!(Math::abs(points[i].x) < coordinateLimit && Math::abs(points[i].y) < coordinateLimit)) return false;
+  }
+  int64_t x[3], y[3];
+  for (uint32_t i = 0; i < 3; i++) x[i] = llroundf(points[i].x * (1 << subpixelBits)), y[i] = llroundf(points[i].y * (1 << subpixelBits));
+  int64_t area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+  if (area == 0) return false;
+  // Positive area is clockwise on the image, the back side
+  if (area > 0 && style.cullBackFaces) return false;
+  const Vertex* ordered[3] = {corners[0], corners[1], corners[2]};
+  if (area < 0) {
+    std::swap(x[1], x[2]), std::swap(y[1], y[2]), std::swap(ordered[1], ordered[2]);
+    area = -area;
+  }
+
+  const int32_t x0 = static_cast<int32_t>(std::min({x[0], x[1], x[2]}) >> subpixelBits), y0 = static_cast<int32_t>(std::min({y[0], y[1], y[2]}) >> subpixelBits);
+  const int32_t x1 = static_cast<int32_t>(std::max({x[0], x[1], x[2]}) >> subpixelBits) + 1, y1 = static_cast<int32_t>(std::max({y[0], y[1], y[2]}) >> subpixelBits) + 1;
+  out.bounds = Rect<int32_t>(x0, y0, x1 - x0, y1 - y0).intersection(clip);
+  if (out.bounds.width <= 0 || out.bounds.height <= 0) return false;
+  // The weight of a vertex is the edge function of the edge across from it
+  out.edges[0] = setupEdge(x[1], y[1], x[2], y[2]);
+  out.edges[1] = setupEdge(x[2], y[2], x[0], y[0]);
+  out.edges[2] = setupEdge(x[0], y[0], x[1], y[1]);
+
+  // Barycentric planes from the edge functions. The top-left bias is far below their precision
+  const double scale = 1.0 / static_cast<double>(area);
+  double lambdaX[3], lambdaY[3], lambdaOrigin[3];
+  for (uint32_t i = 0; i < 3; i++) lambdaX[i] = out.edges[i].stepX * scale, lambdaY[i] = out.edges[i].stepY * scale, lambdaOrigin[i] = out.edges[i].origin * scale;
+  float values[3];
+  for (uint32_t i = 0; i < 3; i++) values[i] = ordered[i]->position.z;
+  out.depth = setupPlane(values, lambdaX, lambdaY, lambdaOrigin);
+  for (uint32_t i = 0; i < 3; i++) values[i] = 1.f / ordered[i]->w;
+  out.inverseW = setupPlane(values, lambdaX, lambdaY, lambdaOrigin);
+  if (style.texture) {
+    for (uint32_t i = 0; i < 3; i++) values[i] = ordered[i]->uv.x / ordered[i]->w;
+    out.u = setupPlane(values, lambdaX, lambdaY, lambdaOrigin);
+    for (uint32_t i = 0; i < 3; i++) values[i] = ordered[i]->uv.y / ordered[i]->w;
+    out.v = setupPlane(values, lambdaX, lambdaY, lambdaOrigin);
+  }
+  out.flatColor = corners[0]->color.value;
+  if (style.shading == Shading::Gouraud) {
+    for (uint32_t channel = 0; channel < 4; channel++) {
+      for (uint32_t i = 0; i < 3; i++) values[i] = ((ordered[i]->color.value >> (channel * 8)) & 0xFF) / ordered[i]->w;
+      out.color[channel] = setupPlane(values, lambdaX, lambdaY, lambdaOrigin);
+    }
+  }
+  return true;
+}
+
+// Everything a tile needs to shade pixels
+struct ShadeContext {
+  Image& image;
+  const Kernels::Stencil& stencil;
+  const TriangleStyle& style;
+  PixelFormat format;
+  bool gouraud;
+};
+
+// * Shades the covered pixels of one row. inside(i) tells if pixel x + i is covered
+template <typename Mode, typename Inside> static void shadeRow(const ShadeContext& context, const SetupTriangle& triangle, int32_t x, int32_t y, int32_t count, Inside inside) {
+  float depth = triangle.depth.at(x, y), inverseW = triangle.inverseW.at(x, y);
+  float u = 0, v = 0, channels[4] = {0, 0, 0, 0};
+  const Image* texture = context.style.texture;
+  if (texture) u = triangle.u.at(x, y), v = triangle.v.at(x, y);
+  if (context.gouraud) {
+    for (uint32_t c = 0; c < 4; c++) channels[c] = triangle.color[c].at(x, y);
+  }
+  const float steps[8] = {float(triangle.depth.dx), float(triangle.inverseW.dx), float(triangle.u.dx), float(triangle.v.dx), float(triangle.color[0].dx), float(triangle.color[1].dx), float(triangle.color[2].dx), float(triangle.color[3].dx)};
+  uint32_t* pixels = context.image.row(y) + x;
+  float* depths = context.style.depth ? context.style.depth->row(y) + x : nullptr;
+  const Kernels::StencilSpan stencil = context.stencil.span(x, y);
+  for (int32_t i = 0; i < count; i++) {
+    if (inside(i) && (!depths || depth < depths[i])) {
+      const float w = 1.f / inverseW;
+      uint32_t color = triangle.flatColor;
+      if (context.gouraud) {
+        color = 0;
+        for (uint32_t c = 0; c < 4; c++) color |= static_cast<uint32_t>(Math::clamp(channels[c] * w + 0.5f, 0.f, 255.f)) << (c * 8);
+      }
+      if (texture) {
+        // Nearest texel, repeating
+        const float tu = u * w, tv = v * w;
+        const int32_t tx = Math::wrap(static_cast<int32_t>(floorf((tu - floorf(tu)) * texture->width())), texture->width());
+        const int32_t ty = Math::wrap(static_cast<int32_t>(floorf((tv - floorf(tv)) * texture->height())), texture->height());
+        uint32_t texel = texture->row(ty)[tx];
+        if (texture->pixelFormat() == PixelFormat::BGRA) texel = Kernels::swapRB(texel);
+        else if (texture->pixelFormat() == PixelFormat::Custom) texel = texture->unpack(texel).value;
+        uint32_t tinted = 0;
+        for (uint32_t shift = 0; shift < 32; shift += 8) tinted |= Kernels::mul255((texel >> shift) & 0xFF, (color >> shift) & 0xFF) << shift;
+        color = tinted;
+      }
+      const uint32_t packed = context.format == PixelFormat::RGBA ? color : context.format == PixelFormat::BGRA ? Kernels::swapRB(color) : context.image.pack(Color(color));
+      if (stencil.data) Kernels::stencilPixel<Mode>(pixels[i], stencil.data[i], stencil.mode, packed, 255);
+      else if (Mode::replaces(packed)) pixels[i] = packed;
+      else if (!Mode::skips(packed)) pixels[i] = Mode::apply(pixels[i], packed, 255);
+      if (depths) depths[i] = depth;
+    }
+    depth += steps[0], inverseW += steps[1];
+    if (texture) u += steps[2], v += steps[3];
+    if (context.gouraud) {
+      for (uint32_t c = 0; c < 4; c++) channels[c] += steps[4 + c];
+    }
+  }
+}
+
+// * Rasterizes the part of a triangle inside area, block by block
+template <typename Mode> static void rasterizeTriangle(const ShadeContext& context, const SetupTriangle& triangle, const Rect<int32_t>& area) {
+  const int32_t left = area.x & ~(blockSize - 1), top = area.y & ~(blockSize - 1);
+  for (int32_t by = top; by < area.bottom(); by += blockSize) {
+    for (int32_t bx = left; bx < area.right(); bx += blockSize) {
+      const int32_t x0 = Math::max(bx, area.x), y0 = Math::max(by, area.y);
+      const int32_t x1 = Math::min(bx + blockSize, area.right()), y1 = Math::min(by + blockSize, area.bottom());
+      // Edges are linear, so the block's extremes are at its corner pixels
+      bool outside = false, covered = true;
+      for (const Edge& edge : triangle.edges) {
+        const int64_t a = edge.at(x0, y0), b = edge.at(x1 - 1, y0), c = edge.at(x0, y1 - 1), d = edge.at(x1 - 1, y1 - 1);
+        if ((a & b & c & d) < 0) outside = true;
+        if ((a | b | c | d) < 0) covered = false;
+      }
+      if (outside) continue;
+      for (int32_t y = y0; y < y1; y++) {
+        if (covered) {
+          shadeRow<Mode>(context, triangle, x0, y, x1 - x0, [](int32_t) { return true; });
+          continue;
+        }
+        const int64_t e0 = triangle.edges[0].at(x0, y), e1 = triangle.edges[1].at(x0, y), e2 = triangle.edges[2].at(x0, y);
+        const int64_t s0 = triangle.edges[0].stepX, s1 = triangle.edges[1].stepX, s2 = triangle.edges[2].stepX;
+        // Inside when no edge function is negative, so all three sign bits are clear
+        bool mask[blockSize];
+        for (int32_t i = 0; i < blockSize; i++) mask[i] = ((e0 + s0 * i) | (e1 + s1 * i) | (e2 + s2 * i)) >= 0;
+        shadeRow<Mode>(context, triangle, x0, y, x1 - x0, [&](int32_t i) { return mask[i]; });
+      }
+    }
+  }
+}
+
+static void drawTriangles(Image& image, const Vertex* vertices, const uint32_t* indices, size_t indexCount, const TriangleStyle& style) {
+  MV_ASSERT(image.data(), "Cannot draw triangles: Image data is null!");
+  MV_ASSERT(!style.depth || style.depth->size() == image.size(), "Depth buffer size doesn't match the image!");
+  MV_ASSERT(!style.texture || style.texture->data(), "Cannot draw triangles: Texture data is null!");
+  const Rect<int32_t> clip = image.clipRect();
+  if (clip.width <= 0 || clip.height <= 0 || indexCount < 3) return;
+
+  MeshScratch& scratch = Kernels::callScratch<MeshScratch>();
+  std::vector<SetupTriangle>& triangles = scratch.triangles;
+  std::vector<std::vector<uint32_t>>& tiles = scratch.tiles;
+  triangles.clear();
+  uint64_t pixels = 0;
+  for (size_t i = 0; i + 2 < indexCount; i += 3) {
+    const Vertex* corners[3];
+    for (uint32_t j = 0; j < 3; j++) corners[j] = indices ? &vertices[indices[i + j]] : &vertices[i + j];
+    triangles.emplace_back();
+    if (!setupTriangle(image, corners, style, clip, triangles.back())) triangles.pop_back();
+    else pixels += static_cast<uint64_t>(triangles.back().bounds.width) * triangles.back().bounds.height;
+  }
+  if (triangles.empty()) return;
+
+  // Bin every triangle into the tiles its bounds touch, keeping the mesh order inside a tile
+  const int32_t columns = (clip.right() - 1) / tileSize - clip.x / tileSize + 1, rows = (clip.bottom() - 1) / tileSize - clip.y / tileSize + 1;
+  const int32_t firstColumn = clip.x / tileSize, firstRow = clip.y / tileSize;
+  tiles.resize(columns * rows);
+  for (std::vector<uint32_t>& tile : tiles) tile.clear();
+  for (uint32_t t = 0; t < triangles.size(); t++) {
+    const Rect<int32_t>& bounds = triangles[t].bounds;
+    for (int32_t row = bounds.y / tileSize; row <= (bounds.bottom() - 1) / tileSize; row++)
+      for (int32_t column = bounds.x / tileSize; column <= (bounds.right() - 1) / tileSize; column++) tiles[(row - firstRow) * columns + column - firstColumn].push_back(t);
+  }
+
+  const Kernels::Stencil stencil(image);
+  const ShadeContext context{image, stencil, style, image.pixelFormat(), style.shading == Shading::Gouraud};
+  Kernels::withBlendMode(image.blendMode(), [&](auto mode) {
+    using Mode = decltype(mode);
+    const uint32_t count = tiles.size();
+    Kernels::parallelFor(count, pixels >= parallelPixels ? 1 : count, [&](uint32_t begin, uint32_t end) {
+      for (uint32_t index = begin; index < end; index++) {
+        const int32_t column = firstColumn + index % columns, row = firstRow + index / columns;
+        const Rect<int32_t> tile = Rect<int32_t>(column * tileSize, row * tileSize, tileSize, tileSize).intersection(clip);
+        for (uint32_t t : tiles[index]) {
+          const Rect<int32_t> area = triangles[t].bounds.intersection(tile);
+          if (area.width > 0 && area.height > 0) rasterizeTriangle<Mode>(context, triangles[t], area);
+        }
+      }
+    });
+  });
+}
+#pragma endregion Rasterizer
+
+#pragma region Draw
+/**
+ * @brief Fill a triangle, optionally textured and depth tested
+ *
+ * @param a First vertex, its color is used for flat shading
+ * @param b Second vertex
+ * @param c Third vertex
+ * @param style Texture, depth buffer, shading and culling
+ */
+void Image::fillTriangle(const Vertex& a, const Vertex& b, const Vertex& c, const TriangleStyle& style) {
+  const Vertex vertices[3] = {a, b, c};
+  drawTriangles(*this, vertices, nullptr, 3, style);
+}
+
+/**
+ * @brief Draw an indexed triangle mesh, optionally textured and depth tested. Tiles of the image are drawn on separate threads
+ *
+ * @param vertices Vertices of the mesh
+ * @param indices Three vertex indices per triangle, or null to take the vertices three at a time
+ * @param indexCount Number of indices, or of vertices when indices is null
+ * @param style Texture, depth buffer, shading and culling
+ */
+void Image::drawMesh(const Vertex* vertices, const uint32_t* indices, size_t indexCount, const TriangleStyle& style) { drawTriangles(*this, vertices, indices, indexCount, style); }
+#pragma endregion Draw
+} // namespace Mova
@@ -0,0 +1,118 @@
+#include "lib/OreonMath.hpp"
+#include "lib/logassert.h"
+#include "movaImage.hpp"
+#include "movaKernels.hpp"
+#include <cmath>
+
+/*
+--- Point batches ---
+Particles come as structure of arrays. Their pixel bounds are computed for the whole batch in flat loops the compiler
+vectorizes, culled against the clip, and the visible ones are filled by row bands, one band per thread for large batches
+*/
+
+using namespace VectorMath;
+
+namespace Mova {
+// Batches this large are split into row bands across threads
+static constexpr size_t parallelPoints = 4096;
+
+// Placed squares of a batch, and the indices and packed colors of the visible ones
+struct PointScratch {
+  std::vector<int32_t> left, top, width, height;
+  std::vector<uint32_t> visible, packed;
+};
+
+// * Pixel bounds along one axis of squares of side size * |scale| centered on x * scale + offset. Plain restrict arrays and
+// no floorf (a library call without SSE4.1), so it vectorizes
+static void placePoints(const float* __restrict x, const float* __restrict sizes, float scale, float offset, size_t count, int32_t* __restrict start, int32_t* __restrict extent) {
+  const float sizeScale = fabsf(scale);
+  for (size_t i = 0; i < count; i++) {
+    // Clamped, so far away points and huge sizes stay in range of int32_t
+    const int32_t size = Math::max(static_cast<int32_t>(fminf((sizes ? sizes[i] : 1.f) * sizeScale + 0.5f, 1e9f)), 1);
+    const float from = fminf(fmaxf(x[i] * scale + offset - size * 0.5f + 0.5f, -1e9f), 1e9f);
+    const int32_t truncated = static_cast<int32_t>(from);
+    start[i] = truncated - (static_cast<float>(truncated) > from);
+    extent[i] = size;
+  }
+}
+
+template <typename Colors> static void drawPointBatch(Image& image, const float* x, const float* y, const float* sizes, Colors colorAt, size_t count) {
+  MV_ASSERT(image.data(), "Cannot drawPoints: Image data is null!");
+  if (count == 0) return;
+  const mat3f& transform = image.transform();
+  if (image.hasTransform() && !transform.isAxisAligned()) {
+    // Rotated squares go through fillRect one by one
+    for (size_t i = 0; i < count; i++) {
+      const float size = sizes ? sizes[i] : 1.f;
+      const int32_t side = Math::max(static_cast<int32_t>(size + 0.5f), 1);
+      image.fillRect(static_cast<int32_t>(floorf(x[i] - side * 0.5f + 0.5f)), static_cast<int32_t>(floorf(y[i] - side * 0.5f + 0.5f)), side, side, colorAt(i));
+    }
+    return;
+  }
+  const Rect<int32_t> clip = image.clipRect();
+  if (clip.width <= 0 || clip.height <= 0) return;
+
+  PointScratch& scratch = Kernels::callScratch<PointScratch>();
+  std::vector<int32_t> &left = scratch.left, &top = scratch.top, &width = scratch.width, &height = scratch.height;
+  std::vector<uint32_t> &visible = scratch.visible, &packed = scratch.packed;
+  left.resize(count), top.resize(count), width.resize(count), height.resize(count);
+  const bool mapped = image.hasTransform();
+  placePoints(x, sizes, mapped ? transform.m[0][0] : 1.f, mapped ? transform.m[0][2] : 0.f, count, left.data(), width.data());
+  placePoints(y, sizes, mapped ? transform.m[1][1] : 1.f, mapped ? transform.m[1][2] : 0.f, count, top.data(), height.data());
+
+  // Cull, and pack the colors of what is left without going through the color mode for the built-in formats
+  visible.clear(), packed.clear();
+  const PixelFormat format = image.pixelFormat();
+  const bool copies = image.blendMode() == BlendMode::Copy;
+  for (size_t i = 0; i < count; i++) {
+    if (left[i] >= clip.right() || top[i] >= clip.bottom() || left[i] + width[i] <= clip.x || top[i] + height[i] <= clip.y) continue;
+    const Color color = colorAt(i);
+    if (color.a == 0 && !copies) continue;
+    visible.push_back(i);
+    packed.push_back(format == PixelFormat::RGBA ? color.value : format == PixelFormat::BGRA ? Kernels::swapRB(color.value) : image.pack(color));
+  }
+  if (visible.empty()) return;
+
+  const Kernels::Stencil stencil(image);
+  Kernels::withBlendMode(image.blendMode(), [&](auto mode) {
+    using Mode = decltype(mode);
+    Kernels::parallelFor(clip.height, visible.size() >= parallelPoints ? 32 : clip.height, [&](uint32_t begin, uint32_t end) {
+      const int32_t bandTop = clip.y + begin, bandBottom = clip.y + end;
+      for (size_t j = 0; j < visible.size(); j++) {
+        const uint32_t i = visible[j];
+        const int32_t y0 = Math::max(top[i], bandTop), y1 = Math::min(top[i] + height[i], bandBottom);
+        if (y0 >= y1) continue;
+        const int32_t x0 = Math::max(left[i], clip.x), x1 = Math::min(left[i] + width[i], clip.right());
+        for (int32_t row = y0; row < y1; row++) Kernels::fillSpan<Mode>(image.row(row) + x0, x1 - x0, packed[j], stencil.span(x0, row));
+      }
+    });
+  });
+}
+
+/**
+ * @brief Fill a batch of squares given as structure of arrays, like particles
+ *
+ * @param x Center x of every point
+ * @param y Center y of every point
+ * @param sizes Side of every square, rounded to whole pixels. Null draws single pixels
+ * @param colors Color of every point
+ * @param count Number of points
+ */
+void Image::drawPoints(const float* x, const float* y, const float* sizes, const Color* colors, size_t count) {
+  drawPointBatch(*this, x, y, sizes, [&](size_t i) { return colors[i]; }, count);
+}
+
+/**
+ * @brief Fill a batch of squares of one color given as structure of arrays, like particles
+ *
+ * @param x Center x of every point
+ * @param y Center y of every point
+ * @param sizes Side of every square, rounded to whole pixels. Null draws single pixels
+ * @param color Color of every point
+ * @param count Number of points
+ */
+void Image::drawPoints(const float* x, const float* y, const float* sizes, Color color, size_t count) {
+  if (skipsColor(color)) return;
+  drawPointBatch(*this, x, y, sizes, [&](size_t) { return color; }, count);
+}
+} // namespace Mova
@@ -0,0 +1,196 @@
+#include "lib/OreonMath.hpp"
+#include "lib/logassert.h"
+#include "movaImage.hpp"
+#include "movaKernels.hpp"
+#include <cmath>
+
+/*
+--- Resampling ---
+Separable: rows are filtered horizontally into a float buffer, then its rows are combined vertically. The taps of every
+output column and row are computed once up front, padded to the same count so the inner loops have a fixed length and
+work on four channels at a time. Pixels are premultiplied while filtering, so transparent pixels don't bleed their color.
+Output rows are split into bands for threads, and every band works in chunks of rows to keep its float buffer small.
+Large downscales with the wider filters are averaged with the box filter first, like thumbnailers do
+*/
+
+using namespace VectorMath;
+
+namespace Mova {
+#pragma region Weights
+// Output rows per chunk. Every chunk filters the source rows it needs horizontally, its edges are filtered twice
+static constexpr uint32_t chunkRows = 32;
+// Wider filters shrink by more than this with a box filter first, to twice the final size
+static constexpr uint32_t preshrinkRatio = 3;
+
+// Taps of every output pixel along one axis: source pixels first[i] to first[i] + taps - 1 with their weights,
+// padded with zeros so every pixel has the same number of taps
+struct Contributions {
+  uint32_t taps = 0;
+  std::vector<int32_t> first;
+  std::vector<float> weights;
+};
+
+static float filterSupport(ResampleFilter filter) {
+  switch (filter) {
+  case ResampleFilter::Box: return 0.5f;
+  case ResampleFilter::Bilinear: return 1;
+  case ResampleFilter::Bicubic: return 2;
+  case ResampleFilter::Lanczos: return 3;
+  }
+  return 1;
+}
+
+static float filterWeight(ResampleFilter filter, float x) {
+  x = Math::abs(x);
+  switch (filter) {
+  case ResampleFilter::Box: return x < 0.5f ? 1.f : 0.f;
+  case ResampleFilter::Bilinear: return x < 1 ? 1 - x : 0;
+  case ResampleFilter::Bicubic: // Catmull-Rom, cubic convolution with a = -0.5
+    if (x < 1) return (1.5f * x - 2.5f) * x * x + 1;
+    if (x < 2) return ((-0.5f * x + 2.5f) * x - 4) * x + 2;
+    return 0;
+  case ResampleFilter::Lanczos: {
+    if (x < 1e-6f) return 1;
+    if (x >= 3) return 0;
+    const float px = static_cast<float>(M_PI) * x;
+    return 3 * sinf(px) * sinf(px / 3) / (px * px);
+  }
+  }
+  return 0;
+}
+
+// * Taps mapping `from` source pixels to `to` output pixels. Taps past the edges land on the edge pixels
+static Contributions contributions(uint32_t from, uint32_t to, ResampleFilter filter) {
+  const float ratio = static_cast<float>(from) / to, scale = Math::max(ratio, 1.f);
+  const float reach = filterSupport(filter) * scale;
+  // The box filter weighs every source pixel by how much of it the output pixel covers
+  const bool area = filter == ResampleFilter::Box;
+  std::vector<int32_t> low(to), high(to);
+  uint32_t taps = 1;
+  for (uint32_t i = 0; i < to; i++) {
+    const float center = (i + 0.5f) * ratio;
+    if (area) low[i] = static_cast<int32_t>(floorf(center - scale / 2)), high[i] = static_cast<int32_t>(ceilf(center + scale / 2)) - 1;
+    else low[i] = static_cast<int32_t>(ceilf(center - 0.5f - reach)), high[i] = static_cast<int32_t>(floorf(center - 0.5f + reach));
+    taps = Math::max(taps, static_cast<uint32_t>(high[i] - low[i] + 1));
+  }
+
+  Contributions result;
+  result.taps = Math::min(taps, from);
+  result.first.resize(to);
+  result.weights.assign(static_cast<size_t>(to) * result.taps, 0.f);
+  for (uint32_t i = 0; i < to; i++) {
+    const float center = (i + 0.5f) * ratio;
+    const int32_t first = Math::min(Math::clamp(low[i], 0, static_cast<int32_t>(from) - 1), static_cast<int32_t>(from - result.taps));
+    float* weights = &result.weights[static_cast<size_t>(i) * result.taps];
+    float sum = 0;
+    for (int32_t j = low[i]; j <= high[i]; j++) {
+      float weight;
+      if (area) weight = Math::max(Math::min(j + 1.f, center + scale / 2) - Math::max(static_cast<float>(j), center - scale / 2), 0.f);
+      else weight = filterWeight(filter, (j + 0.5f - center) / scale);
+      weights[Math::clamp(j, 0, static_cast<int32_t>(from) - 1) - first] += weight;
+      sum += weight;
+    }
+    if (sum != 0)
+      for (uint32_t t = 0; t < result.taps; t++) weights[t] /= sum;
+    result.first[i] = first;
+  }
+  return result;
+}
+#pragma endregion Weights
+
+#pragma region Resample
+// * Source row as premultiplied floats, four channels per pixel
+static void loadRow(const Image& image, uint32_t y, float* out) {
+  const uint32_t* row = image.row(y);
+  if (image.pixelFormat() == PixelFormat::Custom) {
+    thread_local std::vector<uint32_t> unpacked;
+    unpacked.resize(image.width());
+    for (uint32_t x = 0; x < image.width(); x++) unpacked[x] = image.unpack(row[x]).value;
+    row = unpacked.data();
+  }
+  for (uint32_t x = 0; x < image.width(); x++) {
+    const uint32_t pixel = row[x];
+    const float alpha = static_cast<float>(pixel >> 24), scale = alpha * (1 / 255.f);
+    out[x * 4 + 0] = (pixel & 0xFF) * scale;
+    out[x * 4 + 1] = ((pixel >> 8) & 0xFF) * scale;
+    out[x * 4 + 2] = ((pixel >> 16) & 0xFF) * scale;
+    out[x * 4 + 3] = alpha;
+  }
+}
+
+static void filterRow(const float* __restrict source, float* __restrict out, const Contributions& columns) {
+  const uint32_t taps = columns.taps, width = columns.first.size();
+  for (uint32_t x = 0; x < width; x++) {
+    const float* pixels = source + columns.first[x] * 4;
+    const float* weights = &columns.weights[static_cast<size_t>(x) * taps];
+    float sum[4] = {0, 0, 0, 0};
+    for (uint32_t t = 0; t < taps; t++)
+      for (uint32_t c = 0; c < 4; c++) sum[c] += weights[t] * pixels[t * 4 + c];
+    for (uint32_t c = 0; c < 4; c++) out[x * 4 + c] = sum[c];
+  }
+}
+
+// * Premultiplied float pixels back to packed straight alpha. Sharp filters overshoot, so everything is clamped
+static void storeRow(const float* sums, Image& image, uint32_t y) {
+  uint32_t* row = image.row(y);
+  const bool custom = image.pixelFormat() == PixelFormat::Custom;
+  for (uint32_t x = 0; x < image.width(); x++) {
+    const float alpha = Math::clamp(sums[x * 4 + 3], 0.f, 255.f);
+    const float scale = alpha > 0 ? 255 / alpha : 0;
+    uint32_t pixel = static_cast<uint32_t>(alpha + 0.5f) << 24;
+    for (uint32_t c = 0; c < 3; c++) pixel |= static_cast<uint32_t>(Math::clamp(sums[x * 4 + c] * scale, 0.f, 255.f) + 0.5f) << (c * 8);
+    row[x] = custom ? image.pack(Color(pixel)) : pixel;
+  }
+}
+
+/**
+ * @brief Resample the image to a new size with separable filters. Rows are resampled on separate threads
+ *
+ * @param size Size of the new image
+ * @param filter Box averages areas (thumbnails), Bilinear, Bicubic and Lanczos are increasingly sharp
+ * @return The resampled image, in this image's pixel format
+ */
+Image Image::resampled(vec2u size, ResampleFilter filter) const {
+  MV_ASSERT(m_Data, "Cannot resample: Image data is null!");
+  MV_ASSERT(size.x > 0 && size.y > 0, "Invalid resample size: %u%%%u", size.x, size.y);
+  // A wide filter over a large downscale reads every source pixel many times, while the box filter reads it once.
+  // Averaging down to twice the final size first leaves the final filter enough pixels to keep its shape
+  const bool shrinkX = m_Width >= size.x * preshrinkRatio, shrinkY = m_Height >= size.y * preshrinkRatio;
+  if (filter != ResampleFilter::Box && (shrinkX || shrinkY)) {
+    const vec2u between(shrinkX ? size.x * 2 : m_Width, shrinkY ? size.y * 2 : m_Height);
+    return resampled(between, ResampleFilter::Box).resampled(size, filter);
+  }
+  Image result(size);
+  result.colorMode = colorMode, result.reverseColorMode = reverseColorMode, result.m_Format = m_Format;
+  const Contributions columns = contributions(m_Width, size.x, filter), rows = contributions(m_Height, size.y, filter);
+  const size_t stride = static_cast<size_t>(size.x) * 4;
+
+  Kernels::parallelFor(size.y, 16, [&](uint32_t begin, uint32_t end) {
+    std::vector<float> source(static_cast<size_t>(m_Width) * 4), filtered, sums(stride);
+    for (uint32_t chunk = begin; chunk < end; chunk += chunkRows) {
+      const uint32_t last = Math::min(chunk + chunkRows, end) - 1;
+      // Taps start at non-decreasing rows, so the chunk needs the rows from its first output row's to its last's
+      const int32_t top = rows.first[chunk], bottom = rows.first[last] + rows.taps;
+      filtered.resize((bottom - top) * stride);
+      for (int32_t y = top; y < bottom; y++) {
+        loadRow(*this, y, source.data());
+        filterRow(source.data(), &filtered[(y - top) * stride], columns);
+      }
+      for (uint32_t y = chunk; y <= last; y++) {
+        std::fill(sums.begin(), sums.end(), 0.f);
+        const float* weights = &rows.weights[static_cast<size_t>(y) * rows.taps];
+        for (uint32_t t = 0; t < rows.taps; t++) {
+          if (weights[t] == 0) continue;
+          const float* __restrict line = &filtered[(rows.first[y] + t - top) * stride];
+          float* __restrict out = sums.data();
+          const float weight = weights[t];
+          for (size_t i = 0; i < stride; i++) out[i] += weight * line[i];
+        }
+        storeRow(sums.data(), result, y);
+      }
+    }
+  });
+  return result;
+}
+#pragma endregion Resample
+} // namespace Mova
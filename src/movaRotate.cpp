@@ -0,0 +1,144 @@
+#include "lib/OreonMath.hpp"
+#include "lib/logassert.h"
+#include "movaImage.hpp"
+#include "movaKernels.hpp"
+#include <cmath>
+
+/*
+--- Rotated images ---
+The image's rect becomes a quad, whose edges are intersected with every row's pixel centers, so only covered pixels are
+visited. Along a row the source position steps by a constant in 16.16 fixed point, one add per axis and pixel. Every row
+samples into a buffer in the target's format and is blended with the span kernels
+*/
+
+using namespace VectorMath;
+
+namespace Mova {
+#pragma region Sampling
+// Fixed point source coordinates limit sources to this size
+static constexpr uint32_t maxSourceSize = 1 << 15;
+
+// * Source pixels with alpha in the top byte: built-in formats as they are, custom ones unpacked to RGBA
+template <bool Custom> static inline uint32_t texel(const Image& image, int32_t x, int32_t y) {
+  const uint32_t pixel = image.row(y)[x];
+  return Custom ? image.unpack(pixel).value : pixel;
+}
+
+// * a to b by f / 256, in the two 32-bit lanes R|B and G|A
+static inline uint32_t lerpPixel(uint32_t a, uint32_t b, uint32_t f) {
+  const uint32_t rb = (((a & 0x00FF00FF) * (256 - f) + (b & 0x00FF00FF) * f) >> 8) & 0x00FF00FF;
+  const uint32_t ga = (((a >> 8) & 0x00FF00FF) * (256 - f) + ((b >> 8) & 0x00FF00FF) * f) & 0xFF00FF00;
+  return rb | ga;
+}
+
+// * Four texels weighted by fx and fy (0 to 255). Channels are weighted by alpha too, so transparent texels don't bleed
+// their color. The channel order doesn't matter as long as alpha is on top
+static inline uint32_t bilinear(uint32_t p00, uint32_t p10, uint32_t p01, uint32_t p11, uint32_t fx, uint32_t fy) {
+  // Texels of one alpha (opaque images) mix their channels directly
+  if ((p00 >> 24) == (p10 >> 24) && (p00 >> 24) == (p01 >> 24) && (p00 >> 24) == (p11 >> 24)) return lerpPixel(lerpPixel(p00, p10, fx), lerpPixel(p01, p11, fx), fy);
+  // Weights sum to 65536, so weight times alpha times channel stays in 32 bits
+  const uint32_t w00 = (256 - fx) * (256 - fy), w10 = fx * (256 - fy), w01 = (256 - fx) * fy, w11 = fx * fy;
+  const uint32_t a00 = w00 * (p00 >> 24), a10 = w10 * (p10 >> 24), a01 = w01 * (p01 >> 24), a11 = w11 * (p11 >> 24);
+  const uint32_t alpha = a00 + a10 + a01 + a11;
+  if (alpha == 0) return 0;
+  const float scale = 1.f / alpha;
+  uint32_t result = ((alpha + 32768) >> 16) << 24;
+  for (uint32_t shift = 0; shift < 24; shift += 8) {
+    const uint32_t sum = ((p00 >> shift) & 0xFF) * a00 + ((p10 >> shift) & 0xFF) * a10 + ((p01 >> shift) & 0xFF) * a01 + ((p11 >> shift) & 0xFF) * a11;
+    result |= static_cast<uint32_t>(sum * scale + 0.5f) << shift;
+  }
+  return result;
+}
+
+// * Samples count pixels starting at source position (u, v), stepping by (du, dv), all in 16.16 fixed point.
+// Positions that drift past the edges by rounding are clamped, bilinear taps past them repeat the edge pixels
+template <bool Bilinear, bool Custom> static void sampleSpan(const Image& image, int32_t u, int32_t v, int32_t du, int32_t dv, uint32_t count, uint32_t* out) {
+  const int32_t lastX = image.width() - 1, lastY = image.height() - 1;
+  if (!Bilinear) {
+    const int32_t maxU = (lastX << 16) | 0xFFFF, maxV = (lastY << 16) | 0xFFFF;
+    for (uint32_t i = 0; i < count; i++, u += du, v += dv) out[i] = texel<Custom>(image, Math::clamp(u, 0, maxU) >> 16, Math::clamp(v, 0, maxV) >> 16);
+    return;
+  }
+  // Bilinear taps are centered on pixel centers, half a pixel before the position
+  u -= 1 << 15, v -= 1 << 15;
+  for (uint32_t i = 0; i < count; i++, u += du, v += dv) {
+    const int32_t cu = Math::clamp(u, 0, lastX << 16), cv = Math::clamp(v, 0, lastY << 16);
+    const int32_t x0 = cu >> 16, y0 = cv >> 16, x1 = Math::min(x0 + 1, lastX), y1 = Math::min(y0 + 1, lastY);
+    out[i] = bilinear(texel<Custom>(image, x0, y0), texel<Custom>(image, x1, y0), texel<Custom>(image, x0, y1), texel<Custom>(image, x1, y1), (cu >> 8) & 0xFF, (cv >> 8) & 0xFF);
+  }
+}
+#pragma endregion Sampling
+
+#pragma region Rotate
+/**
+ * @brief Draw an image turned around its center. Only the pixels covered by the turned image are visited
+ *
+ * @param image Image to draw
+ * @param center Where the image's center lands, in the current transform
+ * @param angle Clockwise angle in radians (y points down)
+ * @param scale Size factor, negative values turn the image by another half turn
+ * @param smooth Sample bilinearly instead of the nearest pixel
+ */
+void Image::drawImageRotated(const Image& image, vec2f center, float angle, float scale, bool smooth) {
+  MV_ASSERT(m_Data, "Cannot drawImageRotated: Image data is null!");
+  MV_ASSERT(image.data(), "Cannot drawImageRotated: Other image data is null!");
+  MV_ASSERT(image.width() < maxSourceSize && image.height() < maxSourceSize, "Cannot drawImageRotated: Image is larger than %u pixels", maxSourceSize);
+  if (scale == 0 || image.width() == 0 || image.height() == 0) return;
+
+  const float c = cosf(angle) * scale, s = sinf(angle) * scale;
+  const vec2f half(image.width() / 2.f, image.height() / 2.f);
+  const mat3f toTarget = m_Transform * mat3f(c, -s, center.x - c * half.x + s * half.y, s, c, center.y - s * half.x - c * half.y);
+  const mat3f toSource = toTarget.inverse();
+  const vec2f corners[4] = {toTarget * vec2f(0, 0), toTarget * vec2f(image.width(), 0), toTarget * vec2f(image.width(), image.height()), toTarget * vec2f(0, image.height())};
+  vec2f minP = corners[0], maxP = corners[0];
+  float slopes[4];
+  for (uint32_t i = 0; i < 4; i++) {
+    const vec2f &a = corners[i], &b = corners[(i + 1) & 3];
+    minP = VectorMath::min(minP, a), maxP = VectorMath::max(maxP, a);
+    slopes[i] = a.y != b.y ? (b.x - a.x) / (b.y - a.y) : 0;
+  }
+  const Rect<int32_t> clip = clipRect();
+  const int32_t y0 = Math::max(static_cast<int32_t>(floorf(minP.y)), clip.top()), y1 = Math::min(static_cast<int32_t>(ceilf(maxP.y)), clip.bottom());
+  if (y0 >= y1) return;
+
+  // Source position of pixel (x, y) is origin + x * (du, dv) + y * (rowU, rowV). Spans start from the same fixed point
+  // grid wherever they are clipped, so clipping never moves a sample
+  const vec2f origin = toSource * vec2f(0.5f, 0.5f), stepX = toSource.transformVector(vec2f(1, 0)), stepY = toSource.transformVector(vec2f(0, 1));
+  const int64_t originU = llroundf(origin.x * 65536), originV = llroundf(origin.y * 65536);
+  const int64_t rowU = llroundf(stepY.x * 65536), rowV = llroundf(stepY.y * 65536);
+  const int32_t du = static_cast<int32_t>(lroundf(stepX.x * 65536)), dv = static_cast<int32_t>(lroundf(stepX.y * 65536));
+  const Kernels::PixelConverter convert(image, *this);
+  const bool custom = image.pixelFormat() == PixelFormat::Custom;
+  auto sample = smooth ? (custom ? sampleSpan<true, true> : sampleSpan<true, false>) : (custom ? sampleSpan<false, true> : sampleSpan<false, false>);
+  static thread_local std::vector<uint32_t> line;
+
+  Kernels::withBlendMode(m_BlendMode, [&](auto mode) {
+    using Mode = decltype(mode);
+    const Kernels::Stencil stencil(*this);
+    for (int32_t y = y0; y < y1; y++) {
+      // The quad is convex, so the edges crossing the row's centers bound one span
+      const float middle = y + 0.5f;
+      float left = maxP.x, right = minP.x;
+      for (uint32_t i = 0; i < 4; i++) {
+        const vec2f &a = corners[i], &b = corners[(i + 1) & 3];
+        if ((a.y <= middle) == (b.y <= middle)) continue;
+        const float x = a.x + (middle - a.y) * slopes[i];
+        left = Math::min(left, x), right = Math::max(right, x);
+      }
+      // Pixels whose centers fall inside [left, right)
+      const int32_t x0 = Math::max(static_cast<int32_t>(ceilf(left - 0.5f)), clip.left());
+      const int32_t x1 = Math::min(static_cast<int32_t>(ceilf(right - 0.5f)), clip.right());
+      if (x0 >= x1) continue;
+
+      const uint32_t count = x1 - x0;
+      if (line.size() < count) line.resize(count);
+      const int32_t u = static_cast<int32_t>(originU + rowU * y + int64_t(du) * x0), v = static_cast<int32_t>(originV + rowV * y + int64_t(dv) * x0);
+      sample(image, u, v, du, dv, count, line.data());
+      if (custom) for (uint32_t i = 0; i < count; i++) line[i] = pack(Color(line[i]));
+      else for (uint32_t i = 0; i < count; i++) line[i] = convert(line[i]);
+      Kernels::blendSpan<Mode>(row(y) + x0, line.data(), count, stencil.span(x0, y));
+    }
+  });
+}
+#pragma endregion Rotate
+} // namespace Mova
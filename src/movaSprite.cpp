@@ -0,0 +1,168 @@
+#include "lib/OreonMath.hpp"
+#include "lib/logassert.h"
+#include "movaImage.hpp"
+#include "movaKernels.hpp"
+#include <algorithm>
+#include <numeric>
+
+/*
+--- Sprite batches ---
+Every sprite is resolved once per draw (clipped dest, source rect, packed tint), after which drawing a row of it
+is a gather or a straight blend. Rows are split into bands, and each band draws all sprites crossing it in order
+*/
+
+using namespace VectorMath;
+
+namespace Mova {
+// Batches covering fewer pixels than this stay on the calling thread
+static constexpr uint64_t parallelPixels = 1 << 16;
+
+// * A sprite resolved against the target
+struct PreparedSprite {
+  const Image* image;
+  Kernels::PixelConverter convert;
+  Rect<int32_t> area;   // Clipped dest
+  vec2i origin;         // Unclipped dest top left
+  Rect<uint32_t> source;
+  vec2u size;           // Unclipped dest size
+  uint32_t tint;        // Packed for the target
+  Color tintColor;
+  bool tinted, flipX, flipY;
+  bool direct;          // Rows blend straight from the source
+};
+
+// * Channel-wise product of two packed pixels, the built-in formats keep every channel in its own byte
+static inline uint32_t tintPixel(uint32_t pixel, uint32_t tint) {
+  uint32_t result = 0;
+  for (uint32_t shift = 0; shift < 32; shift += 8) result |= Kernels::mul255((pixel >> shift) & 0xFF, (tint >> shift) & 0xFF) << shift;
+  return result;
+}
+
+// * Tint through colors, for custom formats that may not keep channels in bytes
+static inline uint32_t tintColor(const Image& target, uint32_t pixel, Color tint) {
+  const Color color = target.unpack(pixel);
+  return target.pack(Color(Kernels::mul255(color.r, tint.r), Kernels::mul255(color.g, tint.g), Kernels::mul255(color.b, tint.b), Kernels::mul255(color.a, tint.a)));
+}
+
+template <typename Mode> static void drawSpriteRows(Image& target, const Kernels::Stencil& stencil, const PreparedSprite& sprite, int32_t y0, int32_t y1) {
+  static thread_local std::vector<uint32_t> line;
+  const int32_t width = sprite.area.width;
+  if (line.size() < static_cast<size_t>(width)) line.resize(width);
+  const uint32_t first = sprite.area.x - sprite.origin.x;
+  for (int32_t y = y0; y < y1; y++) {
+    uint32_t v = static_cast<uint64_t>(y - sprite.origin.y) * sprite.source.height / sprite.size.y;
+    if (sprite.flipY) v = sprite.source.height - 1 - v;
+    const uint32_t* source = sprite.image->row(sprite.source.y + v) + sprite.source.x;
+    uint32_t* dst = target.row(y) + sprite.area.x;
+    if (sprite.direct) {
+      Kernels::blendSpan<Mode>(dst, source + first, width, stencil.span(sprite.area.x, y));
+      continue;
+    }
+    // Steps u by the whole and fractional parts of the scale, so columns match drawImage's exactly
+    const uint64_t start = static_cast<uint64_t>(first) * sprite.source.width;
+    const uint32_t step = sprite.source.width / sprite.size.x, extra = sprite.source.width % sprite.size.x;
+    uint32_t u = start / sprite.size.x, error = start % sprite.size.x;
+    for (int32_t i = 0; i < width; i++) {
+      line[i] = sprite.convert(source[sprite.flipX ? sprite.source.width - 1 - u : u]);
+      u += step, error += extra;
+      if (error >= sprite.size.x) error -= sprite.size.x, u++;
+    }
+    if (sprite.tinted && target.pixelFormat() != PixelFormat::Custom) {
+      for (int32_t i = 0; i < width; i++) line[i] = tintPixel(line[i], sprite.tint);
+    } else if (sprite.tinted) {
+      for (int32_t i = 0; i < width; i++) line[i] = tintColor(target, line[i], sprite.tintColor);
+    }
+    Kernels::blendSpan<Mode>(dst, line.data(), width, stencil.span(sprite.area.x, y));
+  }
+}
+
+// * Sprite under a rotation or skew, as a textured quad
+static void drawSpriteQuad(Image& target, const SpriteBatch::Sprite& sprite, Rect<int32_t> dest, Rect<uint32_t> source, bool flipX, bool flipY) {
+  const mat3f& transform = target.transform();
+  const vec2f corners[4] = {transform * vec2f(dest.x, dest.y), transform * vec2f(dest.right(), dest.y), transform * vec2f(dest.right(), dest.bottom()), transform * vec2f(dest.x, dest.bottom())};
+  const float sx = static_cast<float>(source.width) / dest.width, sy = static_cast<float>(source.height) / dest.height;
+  const mat3f destToSource(flipX ? -sx : sx, 0, flipX ? source.right() + dest.x * sx : source.x - dest.x * sx, 0, flipY ? -sy : sy, flipY ? source.bottom() + dest.y * sy : source.y - dest.y * sy);
+  const Kernels::PixelConverter convert(*sprite.image, target);
+  const bool tinted = sprite.tint.value != Color::white.value, custom = target.pixelFormat() == PixelFormat::Custom;
+  const uint32_t tint = target.pack(sprite.tint);
+  const int32_t left = source.x, top = source.y, right = source.right() - 1, bottom = source.bottom() - 1;
+  Kernels::rasterizeQuad(target, corners, destToSource * transform.inverse(), [&](float u, float v) {
+    const uint32_t pixel = convert(sprite.image->row(Math::clamp(static_cast<int32_t>(floorf(v)), top, bottom))[Math::clamp(static_cast<int32_t>(floorf(u)), left, right)]);
+    return !tinted ? pixel : custom ? tintColor(target, pixel, sprite.tint) : tintPixel(pixel, tint);
+  });
+}
+
+/**
+ * @brief Draw every sprite of the batch onto target, in one pass
+ *
+ * @param target Image to draw on, with its clip, translation and blend mode
+ */
+void SpriteBatch::draw(Image& target) {
+  MV_ASSERT(target.data(), "Cannot draw sprites: Image data is null!");
+  if (m_Sprites.empty()) return;
+  // Depth first, then source image for locality. Stable, so sprites of one image keep their order
+  m_Order.resize(m_Sprites.size());
+  std::iota(m_Order.begin(), m_Order.end(), 0);
+  std::stable_sort(m_Order.begin(), m_Order.end(), [&](uint32_t a, uint32_t b) {
+    const Sprite &first = m_Sprites[a], &second = m_Sprites[b];
+    if (first.depth != second.depth) return first.depth < second.depth;
+    return std::less<const Image*>()(first.image, second.image);
+  });
+
+  const mat3f& transform = target.transform();
+  const bool quads = target.hasTransform() && !transform.isAxisAligned();
+  const bool scaled = target.hasTransform() && !transform.isTranslation();
+  const vec2i offset = target.hasTransform() ? round(transform.translationPart()) : vec2i(0, 0);
+  std::vector<PreparedSprite>& prepared = Kernels::callScratch<std::vector<PreparedSprite>>();
+  prepared.clear();
+  Rect<int32_t> bounds(0, 0, 0, 0); // Rows any sprite touches
+  uint64_t pixels = 0;
+  for (uint32_t index : m_Order) {
+    const Sprite& sprite = m_Sprites[index];
+    MV_ASSERT(sprite.image && sprite.image->data(), "Cannot draw sprite: Image data is null!");
+    Rect<uint32_t> source = sprite.source;
+    if (source.width == 0) source.width = sprite.image->width();
+    if (source.height == 0) source.height = sprite.image->height();
+    Rect<int32_t> dest = sprite.dest;
+    bool flipX = sprite.flipX, flipY = sprite.flipY;
+    // A negative size mirrors the sprite, it still covers [x, x + |width|)
+    if (dest.width < 0) dest.width = -dest.width, flipX = !flipX;
+    if (dest.height < 0) dest.height = -dest.height, flipY = !flipY;
+    if (dest.width == 0 || dest.height == 0 || (sprite.tint.a == 0 && target.blendMode() != BlendMode::Copy)) continue;
+    if (quads) {
+      drawSpriteQuad(target, sprite, dest, source, flipX, flipY);
+      continue;
+    }
+    if (scaled) {
+      // Same mapping as drawImage: rounded corners, and mirroring scales flip the sprite
+      const vec2i from = round(transform * vec2f(dest.x, dest.y)), to = round(transform * vec2f(dest.right(), dest.bottom()));
+      dest = Rect<int32_t>(min(from, to), abs(to - from));
+      flipX = flipX != (transform.m[0][0] < 0), flipY = flipY != (transform.m[1][1] < 0);
+      if (dest.width == 0 || dest.height == 0) continue;
+    } else dest.x += offset.x, dest.y += offset.y;
+    Rect<int32_t> area = dest;
+    if (!target.clip(area)) continue;
+
+    const bool tinted = sprite.tint.value != Color::white.value;
+    const bool sameFormat = sprite.image->pixelFormat() != PixelFormat::Custom && sprite.image->pixelFormat() == target.pixelFormat();
+    prepared.push_back(PreparedSprite{sprite.image, Kernels::PixelConverter(*sprite.image, target), area, dest.position(), source,
+                                      vec2u(dest.width, dest.height), target.pack(sprite.tint), sprite.tint, tinted, flipX, flipY,
+                                      sameFormat && !tinted && !flipX && source.width == static_cast<uint32_t>(dest.width)});
+    bounds = bounds.width == 0 ? area : bounds.common(area);
+    pixels += static_cast<uint64_t>(area.width) * area.height;
+  }
+  if (prepared.empty()) return;
+
+  const Kernels::Stencil stencil(target);
+  Kernels::withBlendMode(target.blendMode(), [&](auto mode) {
+    using Mode = decltype(mode);
+    Kernels::parallelFor(bounds.height, pixels >= parallelPixels ? 64 : bounds.height, [&](uint32_t begin, uint32_t end) {
+      const int32_t top = bounds.y + begin, bottom = bounds.y + end;
+      for (const PreparedSprite& sprite : prepared) {
+        const int32_t y0 = Math::max(sprite.area.top(), top), y1 = Math::min(sprite.area.bottom(), bottom);
+        if (y0 < y1) drawSpriteRows<Mode>(target, stencil, sprite, y0, y1);
+      }
+    });
+  });
+}
+} // namespace Mova
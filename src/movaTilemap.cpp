@@ -0,0 +1,139 @@
+#include "lib/OreonMath.hpp"
+#include "lib/logassert.h"
+#include "movaImage.hpp"
+#include "movaKernels.hpp"
+
+/*
+--- Tilemap ---
+Tiles are rendered into chunk images of chunkSize * chunkSize tiles. set only marks the chunk, and draw renders the
+marked chunks it is about to show, so a frame costs one blit per visible chunk however many tiles changed
+*/
+
+using namespace VectorMath;
+
+namespace Mova {
+/**
+ * @brief Create a map of empty tiles
+ *
+ * @param tileset Image of tiles in rows, tile i is at column i % columns and row i / columns. Kept by reference
+ * @param tileSize Size of a tile in pixels
+ * @param size Size of the map in tiles
+ * @param chunkSize Width and height of a cached chunk in tiles
+ */
+Tilemap::Tilemap(const Image& tileset, vec2u tileSize, vec2u size, uint32_t chunkSize)
+    : m_Tileset(&tileset), m_TileSize(tileSize), m_Size(size), m_ChunkSize(chunkSize), m_Format(PixelFormat::RGBA) {
+  MV_ASSERT(tileSize.x > 0 && tileSize.y > 0 && chunkSize > 0, "Tilemap tile and chunk sizes must not be zero!");
+  MV_ASSERT(tileset.width() >= tileSize.x && tileset.height() >= tileSize.y, "Tileset is smaller than one tile!");
+  m_Columns = tileset.width() / tileSize.x;
+  m_ChunkCount = vec2u((size.x + chunkSize - 1) / chunkSize, (size.y + chunkSize - 1) / chunkSize);
+  m_Tiles.assign(size.x * size.y, empty);
+  m_Chunks.resize(m_ChunkCount.x * m_ChunkCount.y);
+  invalidate();
+}
+
+void Tilemap::set(uint32_t x, uint32_t y, Tile tile) {
+  MV_ASSERT(x < m_Size.x && y < m_Size.y, "Tile position is outside the map!");
+  MV_ASSERT(tile == empty || tile < m_OpaqueTiles.size(), "Tile is not in the tileset!");
+  Tile& current = m_Tiles[y * m_Size.x + x];
+  if (current == tile) return;
+  current = tile;
+  m_Chunks[(y / m_ChunkSize) * m_ChunkCount.x + x / m_ChunkSize].dirty = true;
+}
+
+void Tilemap::fill(Rect<uint32_t> area, Tile tile) {
+  const uint32_t x1 = Math::min(area.right(), m_Size.x), y1 = Math::min(area.bottom(), m_Size.y);
+  for (uint32_t y = area.y; y < y1; y++)
+    for (uint32_t x = area.x; x < x1; x++) set(x, y, tile);
+}
+
+void Tilemap::invalidate() {
+  // Which tiles have no transparent pixel, chunks made only of them are copied
+  const uint32_t count = m_Columns * (m_Tileset->height() / m_TileSize.y);
+  m_OpaqueTiles.assign(count, true);
+  const bool custom = m_Tileset->pixelFormat() == PixelFormat::Custom;
+  for (uint32_t tile = 0; tile < count; tile++) {
+    const uint32_t x0 = (tile % m_Columns) * m_TileSize.x, y0 = (tile / m_Columns) * m_TileSize.y;
+    for (uint32_t y = y0; y < y0 + m_TileSize.y && m_OpaqueTiles[tile]; y++) {
+      const uint32_t* row = m_Tileset->row(y);
+      for (uint32_t x = x0; x < x0 + m_TileSize.x; x++) {
+        if ((custom ? m_Tileset->unpack(row[x]).a : row[x] >> 24) != 255) {
+          m_OpaqueTiles[tile] = false;
+          break;
+        }
+      }
+    }
+  }
+  for (Chunk& chunk : m_Chunks) chunk.dirty = true;
+}
+
+void Tilemap::render(Chunk& chunk, vec2u index) {
+  chunk.dirty = false;
+  const vec2u first = index * m_ChunkSize;
+  const vec2u tiles(Math::min(m_ChunkSize, m_Size.x - first.x), Math::min(m_ChunkSize, m_Size.y - first.y));
+  chunk.blank = true, chunk.opaque = true;
+  for (uint32_t y = 0; y < tiles.y; y++) {
+    for (uint32_t x = 0; x < tiles.x; x++) {
+      const Tile tile = get(first.x + x, first.y + y);
+      chunk.blank = chunk.blank && tile == empty;
+      chunk.opaque = chunk.opaque && tile != empty && m_OpaqueTiles[tile];
+    }
+  }
+  if (chunk.blank) return;
+
+  Image& image = chunk.image;
+  const vec2u size = tiles * m_TileSize;
+  if (image.size() != size || image.pixelFormat() != m_Format) {
+    image.setSize(size.x, size.y);
+    if (m_Format != PixelFormat::Custom) image.setPixelFormat(m_Format);
+    image.setBlendMode(BlendMode::Copy);
+  }
+  if (!chunk.opaque) image.clear(Color::transperent);
+  for (uint32_t y = 0; y < tiles.y; y++) {
+    for (uint32_t x = 0; x < tiles.x; x++) {
+      const Tile tile = get(first.x + x, first.y + y);
+      if (tile == empty) continue;
+      image.drawImage(*m_Tileset, x * m_TileSize.x, y * m_TileSize.y, m_TileSize.x, m_TileSize.y, (tile % m_Columns) * m_TileSize.x, (tile / m_Columns) * m_TileSize.y, m_TileSize.x, m_TileSize.y);
+    }
+  }
+}
+
+/**
+ * @brief Draw the map, rendering the changed chunks that are visible
+ *
+ * @param target Image to draw on, with its clip, transform and blend mode
+ * @param position Where the top left of the map goes, moving it by fractions of a tile scrolls smoothly
+ */
+void Tilemap::draw(Image& target, vec2i position) {
+  MV_ASSERT(target.data(), "Cannot draw tilemap: Image data is null!");
+  if (target.pixelFormat() != PixelFormat::Custom && target.pixelFormat() != m_Format) {
+    m_Format = target.pixelFormat();
+    for (Chunk& chunk : m_Chunks) chunk.dirty = true;
+  }
+
+  // Visible chunks, for translations. Other transforms draw every chunk and let drawImage clip
+  const bool translation = !target.hasTransform() || target.transform().isTranslation();
+  vec2u from(0, 0), to = m_ChunkCount;
+  if (translation) {
+    const Rect<int32_t> clip = target.clipRect();
+    const vec2i origin = position + (target.hasTransform() ? round(target.transform().translationPart()) : vec2i(0, 0));
+    const vec2i chunkPixels(m_ChunkSize * m_TileSize.x, m_ChunkSize * m_TileSize.y);
+    const vec2i first = (vec2i(clip.x, clip.y) - origin), last = (vec2i(clip.right(), clip.bottom()) - origin);
+    if (clip.width <= 0 || clip.height <= 0 || last.x <= 0 || last.y <= 0) return;
+    from = vec2u(Math::max(first.x, 0) / chunkPixels.x, Math::max(first.y, 0) / chunkPixels.y);
+    to = vec2u(Math::min<uint32_t>((last.x + chunkPixels.x - 1) / chunkPixels.x, m_ChunkCount.x), Math::min<uint32_t>((last.y + chunkPixels.y - 1) / chunkPixels.y, m_ChunkCount.y));
+  }
+
+  const BlendMode mode = target.blendMode();
+  for (uint32_t y = from.y; y < to.y; y++) {
+    for (uint32_t x = from.x; x < to.x; x++) {
+      Chunk& chunk = m_Chunks[y * m_ChunkCount.x + x];
+      if (chunk.dirty) render(chunk, vec2u(x, y));
+      if (chunk.blank) continue;
+      // Over an opaque chunk is a copy, which skips the per pixel alpha test
+      if (translation && mode == BlendMode::Over && chunk.opaque) target.setBlendMode(BlendMode::Copy);
+      target.drawImage(chunk.image, position.x + x * m_ChunkSize * m_TileSize.x, position.y + y * m_ChunkSize * m_TileSize.y);
+      target.setBlendMode(mode);
+    }
+  }
+}
+} // namespace Mova
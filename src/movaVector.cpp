@@ -0,0 +1,811 @@
+#include "lib/OreonMath.hpp"
+#include "lib/logassert.h"
+#include "movaImage.hpp"
+#include "movaKernels.hpp"
+
+/*
+--- Anti-aliased vector primitives ---
+Coverage is analytic: a pixel is lit by how far its center lies inside the shape, clamped to one pixel.
+Pixel (x, y) covers [x, x + 1) x [y, y + 1), so integer coordinates are pixel corners
+*/
+
+using namespace VectorMath;
+
+namespace Mova {
+#pragma region Coverage
+static thread_local Kernels::CoverageBuffer coverageBuffer;
+
+static uint32_t coverageFromDistance(float distance) {
+  // distance is signed, negative inside. Half a pixel either side of the edge ramps from 0 to 255
+  if (distance <= -0.5f) return 255;
+  if (distance >= 0.5f) return 0;
+  return static_cast<uint32_t>((0.5f - distance) * 255.f + 0.5f);
+}
+
+// * Convex polygon, up to 8 points in any winding. Along a row every edge distance is linear in x,
+// so the lit and the solid spans fall out of the edge equations and only the anti-aliased ends are evaluated per pixel
+static void rasterizeConvex(Kernels::CoverageBuffer& buffer, const vec2f* points, uint32_t count) {
+  vec2f center = 0;
+  for (uint32_t i = 0; i < count; i++) center += points[i];
+  center /= static_cast<float>(count);
+
+  float normalX[8], normalY[8], offsets[8];
+  uint32_t edges = 0;
+  float minY = points[0].y, maxY = points[0].y;
+  for (uint32_t i = 0; i < count; i++) {
+    const vec2f& a = points[i];
+    const vec2f& b = points[(i + 1) % count];
+    minY = Math::min(minY, a.y), maxY = Math::max(maxY, a.y);
+    vec2f edge = b - a;
+    float length = edge.magnitude();
+    if (length < 1e-6f) continue;
+    vec2f normal = vec2f(edge.y, -edge.x) / length;
+    float offset = normal.dot(a);
+    if (normal.dot(center) > offset) normal = -normal, offset = -offset; // Point normals outwards
+    normalX[edges] = normal.x, normalY[edges] = normal.y, offsets[edges] = offset, edges++;
+  }
+  if (edges < 3) return;
+
+  const Rect<int32_t>& bounds = buffer.bounds();
+  const int32_t y0 = Math::max(static_cast<int32_t>(floorf(minY)) - 1, bounds.y);
+  const int32_t y1 = Math::min(static_cast<int32_t>(ceilf(maxY)) + 1, bounds.bottom());
+  for (int32_t y = y0; y < y1; y++) {
+    // Distance to edge i at pixel center x is normalX[i] * x + rowOffset[i]. Lit where all are below 0.5, solid below -0.5
+    const float cy = y + 0.5f;
+    float rowOffset[8];
+    float lo = bounds.x + 0.5f, hi = bounds.right() - 0.5f;
+    float solidLo = lo, solidHi = hi;
+    bool solid = true;
+    for (uint32_t i = 0; i < edges; i++) {
+      const float a = normalX[i], k = rowOffset[i] = normalY[i] * cy - offsets[i];
+      if (a > 1e-6f) hi = Math::min(hi, (0.5f - k) / a), solidHi = Math::min(solidHi, (-0.5f - k) / a);
+      else if (a < -1e-6f) lo = Math::max(lo, (0.5f - k) / a), solidLo = Math::max(solidLo, (-0.5f - k) / a);
+      else {
+        if (k >= 0.5f) lo = INFINITY;
+        if (k > -0.5f) solid = false;
+      }
+    }
+    if (lo > hi) continue;
+
+    const int32_t x0 = static_cast<int32_t>(ceilf(lo - 0.5f));
+    const int32_t x1 = static_cast<int32_t>(floorf(hi - 0.5f)) + 1;
+    if (x0 >= x1) continue;
+    int32_t solid0 = x1, solid1 = x1;
+    if (solid && solidLo <= solidHi) {
+      solid0 = Math::clamp(static_cast<int32_t>(ceilf(solidLo - 0.5f)), x0, x1);
+      solid1 = Math::clamp(static_cast<int32_t>(floorf(solidHi - 0.5f)) + 1, solid0, x1);
+    }
+
+    uint8_t* row = buffer.row(y);
+    auto edge = [&](int32_t from, int32_t to) {
+      for (int32_t x = from; x < to; x++) {
+        const float cx = x + 0.5f;
+        float distance = -INFINITY;
+        for (uint32_t i = 0; i < edges; i++) distance = Math::max(distance, normalX[i] * cx + rowOffset[i]);
+        buffer.add(row, x, coverageFromDistance(distance));
+      }
+    };
+    edge(x0, solid0);
+    std::fill(row + solid0, row + solid1, 255);
+    edge(solid1, x1);
+    buffer.touch(y, x0, x1);
+  }
+}
+
+// * Disc. Rows are split analytically into the solid middle and the anti-aliased rims
+static void rasterizeDisc(Kernels::CoverageBuffer& buffer, vec2f center, float radius) {
+  const Rect<int32_t>& bounds = buffer.bounds();
+  const float outer = radius + 0.5f, inner = radius - 0.5f;
+  const int32_t y0 = Math::max(Math::floor(center.y - outer), bounds.y);
+  const int32_t y1 = Math::min(Math::ceil(center.y + outer), bounds.bottom());
+  for (int32_t y = y0; y < y1; y++) {
+    const float dy = y + 0.5f - center.y;
+    if (Math::abs(dy) >= outer) continue;
+    const float outerDx = sqrtf(outer * outer - dy * dy);
+    const int32_t x0 = Math::max(Math::floor(center.x - outerDx), bounds.x);
+    const int32_t x1 = Math::min(Math::ceil(center.x + outerDx), bounds.right());
+    if (x0 >= x1) continue;
+
+    // Pixels whose centers are inside the inner circle are fully covered
+    int32_t solid0 = x1, solid1 = x1;
+    if (inner > Math::abs(dy)) {
+      const float innerDx = sqrtf(inner * inner - dy * dy);
+      solid0 = Math::clamp(Math::ceil(center.x - innerDx - 0.5f), x0, x1);
+      solid1 = Math::clamp(Math::floor(center.x + innerDx - 0.5f) + 1, solid0, x1);
+    }
+
+    uint8_t* row = buffer.row(y);
+    auto rim = [&](int32_t from, int32_t to) {
+      for (int32_t x = from; x < to; x++) {
+        const float dx = x + 0.5f - center.x;
+        buffer.add(row, x, coverageFromDistance(sqrtf(dx * dx + dy * dy) - radius));
+      }
+    };
+    rim(x0, solid0);
+    std::fill(row + solid0, row + solid1, 255);
+    rim(solid1, x1);
+    buffer.touch(y, x0, x1);
+  }
+}
+#pragma endregion Coverage
+#pragma region Stroke
+static vec2f direction(vec2f a, vec2f b) {
+  vec2f d = b - a;
+  float length = d.magnitude();
+  return length < 1e-6f ? vec2f(0) : d / length;
+}
+
+static void strokeJoin(Kernels::CoverageBuffer& buffer, vec2f point, vec2f in, vec2f out, float radius, const StrokeStyle& style) {
+  if (style.join == LineJoin::Round) {
+    rasterizeDisc(buffer, point, radius);
+    return;
+  }
+  const float turn = in.cross(out);
+  if (Math::abs(turn) < 1e-4f) return; // Straight or reversing, nothing sticks out
+
+  // The outer corner is on the side opposite to the turn
+  const float side = turn > 0 ? -1.f : 1.f;
+  const vec2f outerIn = vec2f(-in.y, in.x) * side, outerOut = vec2f(-out.y, out.x) * side;
+  const vec2f miter = direction(0, outerIn + outerOut);
+  const float cosHalf = miter.dot(outerIn);
+  if (style.join == LineJoin::Miter && cosHalf > 1e-4f && 1.f / cosHalf <= style.miterLimit) {
+    const vec2f quad[] = {point, point + outerIn * radius, point + miter * (radius / cosHalf), point + outerOut * radius};
+    rasterizeConvex(buffer, quad, 4);
+  } else {
+    const vec2f triangle[] = {point, point + outerIn * radius, point + outerOut * radius};
+    rasterizeConvex(buffer, triangle, 3);
+  }
+}
+
+static float strokeReach(const StrokeStyle& style) {
+  const float radius = style.thickness / 2;
+  return radius * (style.join == LineJoin::Miter ? Math::max(style.miterLimit, 1.5f) : 1.5f) + 2;
+}
+
+static void strokePolyline(Kernels::CoverageBuffer& buffer, const vec2f* points, size_t count, const StrokeStyle& style, bool closed) {
+  const float radius = style.thickness / 2;
+  const size_t segments = closed ? count : count - 1;
+  vec2f firstDir = 0, previousDir = 0;
+  // Square caps extend the first and last segments that have a direction, zero length ones at the ends have none
+  size_t capFirst = 0, capLast = segments;
+  if (!closed && style.cap == LineCap::Square) {
+    while (capFirst < segments && direction(points[capFirst], points[capFirst + 1]) == 0) capFirst++;
+    while (capLast > capFirst && direction(points[capLast - 1], points[capLast]) == 0) capLast--;
+  }
+  for (size_t i = 0; i < segments; i++) {
+    vec2f a = points[i], b = points[(i + 1) % count];
+    const vec2f dir = direction(a, b);
+    if (dir == 0) continue;
+    if (firstDir == 0) firstDir = dir;
+    else strokeJoin(buffer, a, previousDir, dir, radius, style);
+    previousDir = dir;
+
+    if (!closed && style.cap == LineCap::Square) {
+      if (i == capFirst) a -= dir * radius;
+      if (i == capLast - 1) b += dir * radius;
+    }
+    const vec2f normal = vec2f(-dir.y, dir.x) * radius;
+    const vec2f quad[] = {a + normal, b + normal, b - normal, a - normal};
+    rasterizeConvex(buffer, quad, 4);
+  }
+
+  if (firstDir == 0) { // Every point is the same, a round or square cap still leaves a dot
+    if (style.cap == LineCap::Round) rasterizeDisc(buffer, points[0], radius);
+    else if (style.cap == LineCap::Square) {
+      const vec2f square[] = {points[0] - radius, points[0] + vec2f(radius, -radius), points[0] + radius, points[0] + vec2f(-radius, radius)};
+      rasterizeConvex(buffer, square, 4);
+    }
+  } else if (closed) strokeJoin(buffer, points[0], previousDir, firstDir, radius, style);
+  else if (style.cap == LineCap::Round) {
+    rasterizeDisc(buffer, points[0], radius);
+    rasterizeDisc(buffer, points[count - 1], radius);
+  }
+}
+#pragma endregion Stroke
+#pragma region Clip
+// * Pixel box of a shape's bounding box grown by reach, clipped by the image's clip rect
+static bool clipBounds(const Image& image, vec2f minP, vec2f maxP, float reach, Rect<int32_t>& area) {
+  const int32_t x0 = static_cast<int32_t>(floorf(minP.x - reach)), y0 = static_cast<int32_t>(floorf(minP.y - reach));
+  area = Rect<int32_t>(x0, y0, static_cast<int32_t>(ceilf(maxP.x + reach)) - x0, static_cast<int32_t>(ceilf(maxP.y + reach)) - y0);
+  return image.clip(area);
+}
+
+// * Clip a shape's bounding box (grown by reach) once, and prepare the coverage buffer for it
+static bool beginCoverage(const Image& image, vec2f minP, vec2f maxP, float reach) {
+  Rect<int32_t> area;
+  if (!clipBounds(image, minP, maxP, reach, area)) return false;
+  coverageBuffer.begin(area);
+  return true;
+}
+
+static void pointBounds(const vec2f* points, size_t count, vec2f& minP, vec2f& maxP) {
+  for (size_t i = 0; i < count; i++) minP = VectorMath::min(minP, points[i]), maxP = VectorMath::max(maxP, points[i]);
+}
+#pragma endregion Clip
+#pragma region Transform
+// * Points mapped through the image's transform, or the points themselves when there is none
+static const vec2f* mapPoints(const Image& image, const vec2f* points, size_t count) {
+  if (!image.hasTransform()) return points;
+  static thread_local std::vector<vec2f> mapped;
+  mapped.resize(count);
+  for (size_t i = 0; i < count; i++) mapped[i] = image.transform() * points[i];
+  return mapped.data();
+}
+
+static const Path& mapPath(const Image& image, const Path& path) {
+  if (!image.hasTransform()) return path;
+  static thread_local Path mapped;
+  mapped = path;
+  return mapped.transform(image.transform());
+}
+
+// Lengths scale by the square root of the area scale, exact for rotations and uniform scales
+static float lengthScale(const Image& image) { return image.hasTransform() ? sqrtf(Math::abs(image.transform().determinant())) : 1.f; }
+
+static StrokeStyle mapStyle(const Image& image, StrokeStyle style) {
+  style.thickness *= lengthScale(image);
+  return style;
+}
+
+// Rotations and uniform scales (with or without mirroring) keep circles circles
+static bool isSimilarity(const mat3f& m) {
+  return m.isAffine() && ((m.m[0][0] == m.m[1][1] && m.m[0][1] == -m.m[1][0]) || (m.m[0][0] == -m.m[1][1] && m.m[0][1] == m.m[1][0]));
+}
+#pragma endregion Transform
+#pragma region Lines
+
+/**
+ * @brief Draw an anti-aliased line with thickness and caps
+ *
+ * @param p1 Start point, in pixels
+ * @param p2 End point, in pixels
+ * @param color Line color
+ * @param style Thickness and caps, the join is unused
+ */
+void Image::drawLine(vec2f p1, vec2f p2, Color color, const StrokeStyle& style) {
+  const vec2f points[] = {p1, p2};
+  drawPolyline(points, 2, color, style);
+}
+
+/**
+ * @brief Draw connected anti-aliased line segments. Overlapping segments and joins are blended once
+ *
+ * @param points Points of the polyline, in pixels
+ * @param count Number of points
+ * @param color Line color
+ * @param style Thickness, caps, joins and miter limit
+ * @param closed Connect the last point back to the first
+ */
+void Image::drawPolyline(const vec2f* points, size_t count, Color color, const StrokeStyle& style, bool closed) {
+  MV_ASSERT(m_Data, "Cannot drawPolyline: Image data is null!");
+  if (count < 2 || style.thickness <= 0 || skipsColor(color)) return;
+  points = mapPoints(*this, points, count);
+  const StrokeStyle mapped = mapStyle(*this, style);
+  vec2f minP = points[0], maxP = points[0];
+  pointBounds(points, count, minP, maxP);
+  if (!beginCoverage(*this, minP, maxP, strokeReach(mapped))) return;
+  strokePolyline(coverageBuffer, points, count, mapped, closed);
+  coverageBuffer.flush(*this, colorMode(color));
+}
+#pragma endregion Lines
+#pragma region Circles
+static uint32_t arcSteps(float radius, float sweep) {
+  // Chord sagitta r * (1 - cos(step / 2)) kept under the flattening tolerance
+  const float step = 2 * acosf(Math::max(1 - 0.2f / Math::max(radius, 0.2f), -1.f));
+  return Math::clamp(static_cast<uint32_t>(ceilf(Math::abs(sweep) / step)), 1u, 1024u);
+}
+
+// * Rows of shapes symmetric around a vertical axis. Widths are measured from the axis: pixels are lit for hole <= |dx| < lit,
+// and solid (no per-pixel work, just a span fill) for solidFrom <= |dx| < solidTo
+struct SymmetricRow {
+  float hole, solidFrom, solidTo, lit;
+};
+
+static float halfWidth(float radiusX, float radiusY, float dy) {
+  if (radiusX <= 0 || radiusY <= 0 || Math::abs(dy) >= radiusY) return -1;
+  return radiusX * sqrtf(1 - (dy * dy) / (radiusY * radiusY));
+}
+
+// Pixel indices whose centers lie in [from, to), clipped
+static void centerRange(float from, float to, int32_t clipX0, int32_t clipX1, int32_t& x0, int32_t& x1) {
+  x0 = Math::max(static_cast<int32_t>(ceilf(from - 0.5f)), clipX0);
+  x1 = Math::max(Math::min(static_cast<int32_t>(ceilf(to - 0.5f)), clipX1), x0);
+}
+
+// stencil is indexed like row, by absolute x
+template <typename Mode, typename Distance> static void blendSymmetricRow(uint32_t* row, Kernels::StencilSpan stencil, int32_t clipX0, int32_t clipX1, float cx, float dy, const SymmetricRow& extent, uint32_t color, Distance distance) {
+  auto edge = [&](int32_t from, int32_t to) {
+    for (int32_t x = from; x < to; x++) {
+      const uint32_t coverage = coverageFromDistance(distance(x + 0.5f - cx, dy));
+      if (stencil.data) Kernels::stencilPixel<Mode>(row[x], stencil.data[x], stencil.mode, color, coverage);
+      else if (coverage) row[x] = Mode::apply(row[x], color, coverage);
+    }
+  };
+
+  for (float side : {-1.f, 1.f}) {
+    int32_t lit0, lit1, solid0, solid1;
+    if (side < 0) {
+      centerRange(cx - extent.lit, cx - extent.hole, clipX0, clipX1, lit0, lit1);
+      centerRange(cx - extent.solidTo, cx - extent.solidFrom, lit0, lit1, solid0, solid1);
+    } else {
+      centerRange(cx + extent.hole, cx + extent.lit, clipX0, clipX1, lit0, lit1);
+      centerRange(cx + extent.solidFrom, cx + extent.solidTo, lit0, lit1, solid0, solid1);
+    }
+    if (lit0 >= lit1) continue;
+    if (solid0 >= solid1) solid0 = solid1 = lit1;
+    edge(lit0, solid0);
+    Kernels::fillSpan<Mode>(row + solid0, solid1 - solid0, color, stencil + solid0);
+    edge(solid1, lit1);
+  }
+}
+
+/**
+ * @brief Fill an anti-aliased ellipse
+ *
+ * @param center Center, in pixels
+ * @param radii Horizontal and vertical radius
+ * @param color Fill color
+ */
+void Image::fillEllipse(vec2f center, vec2f radii, Color color) {
+  MV_ASSERT(m_Data, "Cannot fillEllipse: Image data is null!");
+  if (radii.x <= 0 || radii.y <= 0 || skipsColor(color)) return;
+  if (m_HasTransform) {
+    if (m_Transform.isAxisAligned()) radii = abs(m_Transform.scalePart()) * radii;
+    else if (radii.x == radii.y && isSimilarity(m_Transform)) radii *= lengthScale(*this);
+    else { // Sheared or rotated ellipses go through the path rasterizer
+      static thread_local Path path;
+      path.clear();
+      const uint32_t steps = arcSteps(Math::max(radii.x, radii.y) * lengthScale(*this), 2 * static_cast<float>(M_PI));
+      for (uint32_t i = 0; i < steps; i++) {
+        const float angle = 2 * static_cast<float>(M_PI) * i / steps;
+        path.lineTo(center + vec2f(cosf(angle), sinf(angle)) * radii);
+      }
+      fillPath(path.close(), color);
+      return;
+    }
+    center = m_Transform * center;
+  }
+  // Circles have exact spans. For ellipses the offset curves aren't ellipses, so spans get a pixel of slack
+  const float slack = radii.x == radii.y ? 0.5f : 1.f;
+  Rect<int32_t> area;
+  if (!clipBounds(*this, center - radii, center + radii, slack, area)) return;
+  const uint32_t packed = colorMode(color);
+
+  const float invX2 = 1 / (radii.x * radii.x), invY2 = 1 / (radii.y * radii.y);
+  auto distance = [&](float dx, float dy) {
+    if (slack == 0.5f) return sqrtf(dx * dx + dy * dy) - radii.x;
+    // First-order distance to the ellipse: implicit function over its gradient length
+    const float gx = dx * invX2, gy = dy * invY2;
+    const float gradient = 2 * sqrtf(gx * gx + gy * gy);
+    if (gradient < 1e-6f) return -radii.x;
+    return (dx * gx + dy * gy - 1) / gradient;
+  };
+
+  const Kernels::Stencil stencil(*this);
+  Kernels::withBlendMode(m_BlendMode, [&](auto mode) {
+    for (int32_t y = area.top(); y < area.bottom(); y++) {
+      const float dy = y + 0.5f - center.y;
+      const float lit = halfWidth(radii.x + slack, radii.y + slack, dy);
+      if (lit < 0) continue;
+      blendSymmetricRow<decltype(mode)>(row(y), stencil.span(0, y), area.left(), area.right(), center.x, dy, SymmetricRow{0, 0, halfWidth(radii.x - slack, radii.y - slack, dy), lit}, packed, distance);
+    }
+  });
+}
+
+/**
+ * @brief Fill an anti-aliased circle
+ *
+ * @param center Center, in pixels
+ * @param radius Radius
+ * @param color Fill color
+ */
+void Image::fillCircle(vec2f center, float radius, Color color) { fillEllipse(center, vec2f(radius, radius), color); }
+
+/**
+ * @brief Draw an anti-aliased circle outline
+ *
+ * @param center Center, in pixels
+ * @param radius Radius to the middle of the outline
+ * @param color Outline color
+ * @param thickness Outline thickness
+ */
+void Image::drawCircle(vec2f center, float radius, Color color, float thickness) {
+  MV_ASSERT(m_Data, "Cannot drawCircle: Image data is null!");
+  if (radius <= 0 || thickness <= 0 || skipsColor(color)) return;
+  if (m_HasTransform) {
+    if (!isSimilarity(m_Transform)) { // Non-uniform scales turn it into an ellipse outline
+      StrokeStyle style;
+      style.thickness = thickness;
+      drawArc(center, radius, 0, 2 * static_cast<float>(M_PI), color, style);
+      return;
+    }
+    center = m_Transform * center, radius *= lengthScale(*this), thickness *= lengthScale(*this);
+  }
+  const float outer = radius + thickness / 2, inner = radius - thickness / 2;
+  Rect<int32_t> area;
+  if (!clipBounds(*this, center - outer, center + outer, 0.5f, area)) return;
+  const uint32_t packed = colorMode(color);
+  auto distance = [&](float dx, float dy) { return Math::abs(sqrtf(dx * dx + dy * dy) - radius) - thickness / 2; };
+
+  const Kernels::Stencil stencil(*this);
+  Kernels::withBlendMode(m_BlendMode, [&](auto mode) {
+    for (int32_t y = area.top(); y < area.bottom(); y++) {
+      const float dy = y + 0.5f - center.y;
+      const float lit = halfWidth(outer + 0.5f, outer + 0.5f, dy);
+      if (lit < 0) continue;
+      SymmetricRow extent;
+      extent.lit = lit;
+      extent.hole = Math::max(halfWidth(inner - 0.5f, inner - 0.5f, dy), 0.f);
+      extent.solidFrom = Math::max(halfWidth(inner + 0.5f, inner + 0.5f, dy), 0.f);
+      extent.solidTo = halfWidth(outer - 0.5f, outer - 0.5f, dy);
+      blendSymmetricRow<decltype(mode)>(row(y), stencil.span(0, y), area.left(), area.right(), center.x, dy, extent, packed, distance);
+    }
+  });
+}
+
+/**
+ * @brief Draw an anti-aliased circular arc
+ *
+ * @param center Center, in pixels
+ * @param radius Radius to the middle of the stroke
+ * @param startAngle Start angle in radians, 0 points right and angles grow clockwise on screen
+ * @param endAngle End angle in radians
+ * @param color Stroke color
+ * @param style Thickness and caps
+ */
+void Image::drawArc(vec2f center, float radius, float startAngle, float endAngle, Color color, const StrokeStyle& style) {
+  MV_ASSERT(m_Data, "Cannot drawArc: Image data is null!");
+  if (radius <= 0 || style.thickness <= 0 || skipsColor(color)) return;
+  const float sweep = Math::clamp(endAngle - startAngle, -2 * static_cast<float>(M_PI), 2 * static_cast<float>(M_PI));
+  const uint32_t steps = arcSteps(radius * lengthScale(*this), sweep);
+  static thread_local std::vector<vec2f> points;
+  points.clear();
+  for (uint32_t i = 0; i <= steps; i++) {
+    const float angle = startAngle + sweep * i / steps;
+    points.push_back(m_Transform * (center + vec2f(cosf(angle), sinf(angle)) * radius));
+  }
+  const bool closed = Math::abs(sweep) >= 2 * static_cast<float>(M_PI) - 1e-4f;
+  if (closed) points.pop_back();
+  const StrokeStyle mapped = mapStyle(*this, style);
+  vec2f minP = points[0], maxP = points[0];
+  pointBounds(points.data(), points.size(), minP, maxP);
+  if (!beginCoverage(*this, minP, maxP, strokeReach(mapped))) return;
+  strokePolyline(coverageBuffer, points.data(), points.size(), mapped, closed);
+  coverageBuffer.flush(*this, colorMode(color));
+}
+#pragma endregion Circles
+#pragma region Path
+// Flattening tolerance, in pixels
+static constexpr float pathTolerance = 0.2f;
+
+Path& Path::moveTo(vec2f point) {
+  m_Contours.push_back(Contour{static_cast<uint32_t>(m_Points.size()), 0, false});
+  m_Points.push_back(point);
+  m_Contours.back().count = 1;
+  return *this;
+}
+
+Path& Path::lineTo(vec2f point) {
+  if (m_Contours.empty()) return moveTo(point);
+  m_Points.push_back(point);
+  m_Contours.back().count++;
+  return *this;
+}
+
+Path& Path::quadTo(vec2f control, vec2f point) {
+  if (m_Contours.empty()) moveTo(control);
+  const vec2f start = m_Points.back();
+  // Chord error of n uniform steps is |p0 - 2c + p1| / (4n^2)
+  const float curvature = (start - control * 2 + point).magnitude();
+  const uint32_t steps = Math::clamp(static_cast<uint32_t>(ceilf(sqrtf(curvature / (4 * pathTolerance)))), 1u, 256u);
+  for (uint32_t i = 1; i <= steps; i++) {
+    const float t = static_cast<float>(i) / steps, u = 1 - t;
+    lineTo(start * (u * u) + control * (2 * u * t) + point * (t * t));
+  }
+  return *this;
+}
+
+Path& Path::cubicTo(vec2f control1, vec2f control2, vec2f point) {
+  if (m_Contours.empty()) moveTo(control1);
+  const vec2f start = m_Points.back();
+  // Chord error of n uniform steps is at most 3/4 * max second difference / n^2
+  const float curvature = Math::max((start - control1 * 2 + control2).magnitude(), (control1 - control2 * 2 + point).magnitude());
+  const uint32_t steps = Math::clamp(static_cast<uint32_t>(ceilf(sqrtf(curvature * 3 / (4 * pathTolerance)))), 1u, 256u);
+  for (uint32_t i = 1; i <= steps; i++) {
+    const float t = static_cast<float>(i) / steps, u = 1 - t;
+    lineTo(start * (u * u * u) + control1 * (3 * u * u * t) + control2 * (3 * u * t * t) + point * (t * t * t));
+  }
+  return *this;
+}
+
+Path& Path::close() {
+  if (!m_Contours.empty()) m_Contours.back().closed = true;
+  return *this;
+}
+
+void Path::clear() {
+  m_Points.clear();
+  m_Contours.clear();
+}
+
+Path& Path::rect(Rect<float> rect) { return moveTo(rect.tl()).lineTo(rect.tr()).lineTo(rect.br()).lineTo(rect.bl()).close(); }
+
+Path& Path::roundRect(Rect<float> rect, float rtl, float rtr, float rbl, float rbr) {
+  // Radii are clamped so opposite corners never overlap
+  const float limit = 0.5f * Math::min(rect.width, rect.height);
+  const float radii[4] = {Math::clamp(rtl, 0.f, limit), Math::clamp(rtr, 0.f, limit), Math::clamp(rbr, 0.f, limit), Math::clamp(rbl, 0.f, limit)};
+  const vec2f corners[4] = {rect.tl(), rect.tr(), rect.br(), rect.bl()};
+  const vec2f inward[4] = {vec2f(1, 1), vec2f(-1, 1), vec2f(-1, -1), vec2f(1, -1)};
+  const float quarter = 1.57079632679f;
+  bool first = true;
+  for (uint32_t corner = 0; corner < 4; corner++) {
+    const float radius = radii[corner];
+    const vec2f center = corners[corner] + inward[corner] * radius;
+    const float startAngle = quarter * (2 + corner);
+    const uint32_t steps = radius > 0 ? arcSteps(radius, quarter) : 0;
+    for (uint32_t i = 0; i <= steps; i++) {
+      const float angle = startAngle + quarter * i / Math::max(steps, 1u);
+      const vec2f point = center + vec2f(cosf(angle), sinf(angle)) * radius;
+      if (first) moveTo(point), first = false;
+      else lineTo(point);
+    }
+  }
+  return close();
+}
+
+Path& Path::arc(vec2f center, float radius, float startAngle, float endAngle) {
+  const float sweep = endAngle - startAngle;
+  const uint32_t steps = arcSteps(radius, sweep);
+  const vec2f start = center + vec2f(cosf(startAngle), sinf(startAngle)) * radius;
+  if (m_Contours.empty()) moveTo(start);
+  else lineTo(start);
+  for (uint32_t i = 1; i <= steps; i++) {
+    const float angle = startAngle + sweep * i / steps;
+    lineTo(center + vec2f(cosf(angle), sinf(angle)) * radius);
+  }
+  return *this;
+}
+
+Path& Path::transform(const mat3f& transform) {
+  for (vec2f& point : m_Points) point = transform * point;
+  return *this;
+}
+
+Path& Path::polygon(const vec2f* points, size_t count) {
+  if (count == 0) return *this;
+  moveTo(points[0]);
+  for (size_t i = 1; i < count; i++) lineTo(points[i]);
+  return close();
+}
+
+// * Sparse scanline rasterizer. Every edge deposits signed area deltas into the cells it crosses (like stb_truetype's v2 rasterizer),
+// cells are sorted per row and swept left to right: between two cells the winding is constant, so whole spans are filled at once
+namespace PathRaster {
+struct Cell {
+  int32_t y, x;
+  float delta;
+  bool operator<(const Cell& other) const { return y != other.y ? y < other.y : x < other.x; }
+};
+
+static thread_local std::vector<Cell> cells;
+
+static void addCell(const Rect<int32_t>& bounds, int32_t x, int32_t y, float delta) {
+  if (x >= bounds.right() || delta == 0) return;
+  cells.push_back(Cell{y, x, delta});
+}
+
+// * Edge already clipped to the bounds horizontally, rows outside the bounds are skipped
+static void addEdge(const Rect<int32_t>& bounds, vec2f p0, vec2f p1) {
+  if (p0.y == p1.y) return;
+  float direction = 1;
+  if (p0.y > p1.y) Math::swap(p0, p1), direction = -1;
+  const float dxdy = (p1.x - p0.x) / (p1.y - p0.y);
+  const float top = Math::max(p0.y, static_cast<float>(bounds.y)), bottom = Math::min(p1.y, static_cast<float>(bounds.bottom()));
+  if (top >= bottom) return;
+
+  float x = p0.x + (top - p0.y) * dxdy;
+  for (int32_t y = static_cast<int32_t>(top); y < bottom; y++) {
+    const float dy = Math::min(static_cast<float>(y + 1), bottom) - Math::max(static_cast<float>(y), top);
+    const float xNext = x + dxdy * dy, d = dy * direction;
+    const float x0 = Math::min(x, xNext), x1 = Math::max(x, xNext);
+    const float x0Floor = floorf(x0), x1Ceil = ceilf(x1);
+    const int32_t x0i = static_cast<int32_t>(x0Floor), x1i = static_cast<int32_t>(x1Ceil);
+    if (x1i <= x0i + 1) { // Stays inside one column
+      const float xm = 0.5f * (x + xNext) - x0Floor;
+      addCell(bounds, x0i, y, d - d * xm);
+      addCell(bounds, x0i + 1, y, d * xm);
+    } else { // Crosses columns, split the trapezoid area between them
+      const float s = 1 / (x1 - x0), x0f = x0 - x0Floor, x1f = x1 - x1Ceil + 1;
+      const float a0 = 0.5f * s * (1 - x0f) * (1 - x0f), am = 0.5f * s * x1f * x1f;
+      addCell(bounds, x0i, y, d * a0);
+      if (x1i == x0i + 2) addCell(bounds, x0i + 1, y, d * (1 - a0 - am));
+      else {
+        const float a1 = s * (1.5f - x0f);
+        addCell(bounds, x0i + 1, y, d * (a1 - a0));
+        for (int32_t xi = x0i + 2; xi < x1i - 1; xi++) addCell(bounds, xi, y, d * s);
+        const float a2 = a1 + (x1i - x0i - 3) * s;
+        addCell(bounds, x1i - 1, y, d * (1 - a2 - am));
+      }
+      addCell(bounds, x1i, y, d * am);
+    }
+    x = xNext;
+  }
+}
+
+// * Split at the left and right bounds. Parts outside are pressed flat onto the bound, which keeps their winding for the pixels inside
+static void addClippedEdge(const Rect<int32_t>& bounds, vec2f p0, vec2f p1) {
+  const float left = static_cast<float>(bounds.x), right = static_cast<float>(bounds.right());
+  vec2f pieces[4] = {p0};
+  uint32_t count = 1;
+  float splits[2];
+  uint32_t splitCount = 0;
+  for (float bound : {left, right}) {
+    if ((p0.x < bound) != (p1.x < bound)) splits[splitCount++] = (bound - p0.x) / (p1.x - p0.x);
+  }
+  if (splitCount == 2 && splits[0] > splits[1]) Math::swap(splits[0], splits[1]);
+  for (uint32_t i = 0; i < splitCount; i++) pieces[count++] = p0 + (p1 - p0) * splits[i];
+  pieces[count++] = p1;
+  for (uint32_t i = 0; i + 1 < count; i++) {
+    vec2f a = pieces[i], b = pieces[i + 1];
+    const float mid = (a.x + b.x) / 2;
+    if (mid <= left) a.x = b.x = left;
+    else if (mid >= right) continue; // Right of everything, can't affect pixels inside
+    addEdge(bounds, a, b);
+  }
+}
+
+static uint8_t coverage(float winding, FillRule rule) {
+  float value = Math::abs(winding);
+  if (rule == FillRule::EvenOdd) {
+    value = fmodf(value, 2.f);
+    if (value > 1) value = 2 - value;
+  } else value = Math::min(value, 1.f);
+  return static_cast<uint8_t>(value * 255.f + 0.5f);
+}
+
+static void fill(Kernels::CoverageBuffer& buffer, const Path& path, FillRule rule) {
+  const Rect<int32_t>& bounds = buffer.bounds();
+  cells.clear();
+  for (const Path::Contour& contour : path.contours()) {
+    const vec2f* points = path.points().data() + contour.start;
+    // Fills always close their contours
+    for (uint32_t i = 0; i < contour.count; i++) addClippedEdge(bounds, points[i], points[(i + 1) % contour.count]);
+  }
+  std::sort(cells.begin(), cells.end());
+
+  for (size_t i = 0; i < cells.size();) {
+    const int32_t y = cells[i].y;
+    uint8_t* row = buffer.row(y);
+    const int32_t rowStart = Math::max(cells[i].x, bounds.x);
+    int32_t rowEnd = rowStart;
+    float winding = 0;
+    while (i < cells.size() && cells[i].y == y) {
+      const int32_t x = cells[i].x;
+      while (i < cells.size() && cells[i].y == y && cells[i].x == x) winding += cells[i++].delta;
+      const int32_t next = (i < cells.size() && cells[i].y == y) ? cells[i].x : bounds.right();
+      const int32_t from = Math::max(x, bounds.x), to = Math::min(next, bounds.right());
+      const uint8_t value = coverage(winding, rule);
+      if (from < to && value != 0) std::fill(row + from, row + to, value), rowEnd = to;
+    }
+    if (rowEnd > rowStart) buffer.touch(y, rowStart, rowEnd);
+  }
+}
+} // namespace PathRaster
+
+static bool beginPathCoverage(const Image& image, const Path& path, float reach) {
+  if (path.points().empty()) return false;
+  vec2f minP = path.points()[0], maxP = path.points()[0];
+  pointBounds(path.points().data(), path.points().size(), minP, maxP);
+  return beginCoverage(image, minP, maxP, reach);
+}
+
+/**
+ * @brief Fill a path with anti-aliasing. Contours are closed implicitly
+ *
+ * @param path The path
+ * @param color Fill color
+ * @param rule Which areas count as inside when contours overlap or self-intersect
+ */
+void Image::fillPath(const Path& path, Color color, FillRule rule) {
+  MV_ASSERT(m_Data, "Cannot fillPath: Image data is null!");
+  if (skipsColor(color)) return;
+  const Path& mapped = mapPath(*this, path);
+  if (!beginPathCoverage(*this, mapped, 1)) return;
+  PathRaster::fill(coverageBuffer, mapped, rule);
+  coverageBuffer.flush(*this, colorMode(color));
+}
+
+/**
+ * @brief Fill a path with a gradient
+ *
+ * @param path The path
+ * @param gradient Gradient paint, in the same coordinates as the shape
+ * @param rule Which areas count as inside when contours overlap or self-intersect
+ */
+void Image::fillPath(const Path& path, const Gradient& gradient, FillRule rule) {
+  MV_ASSERT(m_Data, "Cannot fillPath: Image data is null!");
+  const Path& mapped = mapPath(*this, path);
+  if (!beginPathCoverage(*this, mapped, 1)) return;
+  PathRaster::fill(coverageBuffer, mapped, rule);
+  coverageBuffer.flushShaded(*this, Kernels::GradientShader(gradient, *this));
+}
+
+/**
+ * @brief Fill an anti-aliased rounded rectangle with a gradient
+ *
+ * @param gradient Gradient paint, in the same coordinates as the shape
+ * @param rtl Top left radius
+ * @param rtr Top right radius
+ * @param rbl Bottom left radius
+ * @param rbr Bottom right radius
+ */
+void Image::fillRoundRect(int32_t x, int32_t y, int32_t width, int32_t height, const Gradient& gradient, uint8_t rtl, uint8_t rtr, uint8_t rbl, uint8_t rbr) {
+  if (width < 0) x += width, width = -width;
+  if (height < 0) y += height, height = -height;
+  static thread_local Path path;
+  path.clear();
+  path.roundRect(Rect<float>(x, y, width, height), rtl, rtr, rbl, rbr);
+  fillPath(path, gradient);
+}
+
+/**
+ * @brief Stroke every contour of a path, overlaps are blended once
+ *
+ * @param path The path
+ * @param color Stroke color
+ * @param style Thickness, caps, joins and miter limit
+ */
+void Image::strokePath(const Path& path, Color color, const StrokeStyle& style) {
+  MV_ASSERT(m_Data, "Cannot strokePath: Image data is null!");
+  if (style.thickness <= 0 || skipsColor(color)) return;
+  const Path& mapped = mapPath(*this, path);
+  const StrokeStyle mappedStyle = mapStyle(*this, style);
+  if (!beginPathCoverage(*this, mapped, strokeReach(mappedStyle))) return;
+  for (const Path::Contour& contour : mapped.contours()) {
+    if (contour.count < 2) continue;
+    strokePolyline(coverageBuffer, mapped.points().data() + contour.start, contour.count, mappedStyle, contour.closed);
+  }
+  coverageBuffer.flush(*this, colorMode(color));
+}
+
+// * Coverage buffer over the part of a mask a path's bounds (grown by reach) touch
+static bool beginMaskCoverage(const Mask& mask, const Path& path, float reach) {
+  if (!mask.data() || path.points().empty()) return false;
+  vec2f minP = path.points()[0], maxP = path.points()[0];
+  pointBounds(path.points().data(), path.points().size(), minP, maxP);
+  const int32_t x0 = Math::max(static_cast<int32_t>(floorf(minP.x - reach)), 0), y0 = Math::max(static_cast<int32_t>(floorf(minP.y - reach)), 0);
+  const int32_t x1 = Math::min(static_cast<int32_t>(ceilf(maxP.x + reach)), static_cast<int32_t>(mask.width()));
+  const int32_t y1 = Math::min(static_cast<int32_t>(ceilf(maxP.y + reach)), static_cast<int32_t>(mask.height()));
+  if (x0 >= x1 || y0 >= y1) return false;
+  coverageBuffer.begin(Rect<int32_t>(x0, y0, x1 - x0, y1 - y0));
+  return true;
+}
+
+/**
+ * @brief Add a path's anti-aliased fill to the mask, so the shape is rasterized once and drawn with Image::fillMask
+ *
+ * @param path The path, in mask pixels
+ * @param rule Which areas count as inside when contours overlap or self-intersect
+ */
+void Mask::fillPath(const Path& path, FillRule rule) {
+  if (!beginMaskCoverage(*this, path, 1)) return;
+  PathRaster::fill(coverageBuffer, path, rule);
+  coverageBuffer.flush(*this);
+}
+
+/**
+ * @brief Add a path's anti-aliased stroke to the mask
+ *
+ * @param path The path, in mask pixels
+ * @param style Thickness, caps, joins and miter limit
+ */
+void Mask::strokePath(const Path& path, const StrokeStyle& style) {
+  if (style.thickness <= 0 || !beginMaskCoverage(*this, path, strokeReach(style))) return;
+  for (const Path::Contour& contour : path.contours()) {
+    if (contour.count < 2) continue;
+    strokePolyline(coverageBuffer, path.points().data() + contour.start, contour.count, style, contour.closed);
+  }
+  coverageBuffer.flush(*this);
+}
+#pragma endregion Path
+} // namespace Mova